@@ -0,0 +1,304 @@
+#pragma once
+
+#include"translator.h"
+
+/// Number of lanes in one vector
+const size_t BATCH_WIDTH = 4;
+
+/// Values of one slot in all lanes of the vector (AVX on x86-64 or split by the compiler)
+typedef double BatchValue __attribute__((vector_size(BATCH_WIDTH * sizeof(double))));
+/// Lane mask: all bits set for the chosen lanes
+typedef long long BatchMask __attribute__((vector_size(BATCH_WIDTH * sizeof(long long))));
+
+/// How the lane stopped
+enum LaneError
+{
+    LANE_OK = 0,       /// END or jump past the last command
+    LANE_DIV_ZERO,
+    LANE_NEG_SQRT,
+    LANE_MANY_BEGIN,
+    LANE_NO_INPUT,     /// INPUT after all numbers of the lane are read
+    LANE_WRONG_COMMAND
+};
+
+/// Inputs and results of the lanes, lane i uses the i-th part of every array
+struct BatchLanes
+{
+    size_t number;            /// Number of lanes
+    const double* inputs;     /// inputs_per_lane numbers for every lane, read by INPUT
+    size_t inputs_per_lane;
+    double* outputs;          /// outputs_per_lane numbers for every lane, written by OUTPUT
+    size_t outputs_per_lane;
+    size_t* output_counts;    /// Number of OUTPUT commands of every lane (extra values are dropped)
+    int* errors;              /// LaneError of every lane
+};
+
+/// Vectors are passed by reference: their ABI depends on the AVX support
+void BatchBlend(const BatchMask& mask, const BatchValue& res, BatchValue* dst)
+{
+    *dst = (BatchValue)(((BatchMask)res & mask) | ((BatchMask)*dst & ~mask));
+}
+
+void BatchBlend(const BatchMask& mask, const BatchMask& res, BatchMask* dst)
+{
+    *dst = (res & mask) | (*dst & ~mask);
+}
+
+/// Lanes of one vector running the register form.
+/// Every lane has its own position, the command at the lowest position
+/// is executed for all lanes standing on it, the others are masked off
+class BatchGroup
+{
+    private:
+        const Translator* program;
+        BatchValue* frame;
+        BatchMask ZF;
+        BatchMask above;
+        size_t pos[BATCH_WIDTH];
+        bool running[BATCH_WIDTH];
+        size_t lane[BATCH_WIDTH];   /// Index of the lane in BatchLanes
+        size_t read[BATCH_WIDTH];   /// Numbers read by INPUT
+        BatchLanes* lanes;
+
+        void SetFlags(const BatchMask& mask, const BatchValue& res);
+        void Stop(size_t i, int error);
+        void Scalar(const RegInstr* cur, const BatchMask& mask, bool* taken);
+
+    public:
+        BatchGroup(const Translator* translator, BatchLanes* batch_lanes)
+        {
+            program = translator;
+            lanes = batch_lanes;
+            /// new[] doesn't align vectors before C++17
+            void* memory = NULL;
+            if(posix_memalign(&memory, sizeof(BatchValue), translator->frame_size * sizeof(BatchValue)) != 0)
+            {
+                printf("Memory error\n");
+                exit(1);
+            }
+            frame = (BatchValue*)memory;
+        }
+        void Run(size_t first);
+        ~BatchGroup()
+        {
+            free(frame);
+        }
+};
+
+///@note Flags of "Compare(res, 0)" in every chosen lane
+void BatchGroup::SetFlags(const BatchMask& mask, const BatchValue& res)
+{
+    BatchMask zero = (res < eps) & (res >= -eps);
+    BatchMask positive = (res >= eps);
+    BatchBlend(mask, zero, &ZF);
+    BatchBlend(mask, positive, &above);
+}
+
+void BatchGroup::Stop(size_t i, int error)
+{
+    running[i] = false;
+    lanes->errors[lane[i]] = error;
+}
+
+///@note Commands without vector form, lane by lane
+void BatchGroup::Scalar(const RegInstr* cur, const BatchMask& mask, bool* taken)
+{
+    for(size_t i = 0; i < BATCH_WIDTH; ++i)
+    {
+        if(mask[i] == 0)
+            continue;
+        double a = frame[cur->a][i];
+        double b = frame[cur->b][i];
+        switch(cur->op)
+        {
+            case R_MOD:
+                if(Compare(b, 0) == 0)
+                {
+                    Stop(i, LANE_DIV_ZERO);
+                    break;
+                }
+                frame[cur->dst][i] = (int)a % (int)b;
+                break;
+            case R_SQRT:
+                if(Compare(a, 0) == -1)
+                {
+                    Stop(i, LANE_NEG_SQRT);
+                    break;
+                }
+                frame[cur->dst][i] = sqrt(a);
+                break;
+            case R_ABS:
+                frame[cur->dst][i] = fabs(a);
+                break;
+            case R_CMP:
+            case R_CJE:
+            case R_CJNE:
+            case R_CJB:
+            case R_CJBE:
+            case R_CJA:
+            case R_CJAE:
+            {
+                /// Same truncation as in Processor::CommandCmp
+                int res = a - b;
+                ZF[i] = (Compare(res, 0) == 0) ? -1 : 0;
+                above[i] = (Compare(res, 0) > 0) ? -1 : 0;
+                break;
+            }
+            case R_INPUT:
+                if(read[i] == lanes->inputs_per_lane)
+                {
+                    Stop(i, LANE_NO_INPUT);
+                    break;
+                }
+                frame[cur->dst][i] = lanes->inputs[lane[i] * lanes->inputs_per_lane + read[i]++];
+                break;
+            case R_OUTPUT:
+            {
+                size_t* count = &lanes->output_counts[lane[i]];
+                if(*count < lanes->outputs_per_lane)
+                    lanes->outputs[lane[i] * lanes->outputs_per_lane + *count] = a;
+                ++*count;
+                break;
+            }
+            case R_END:
+            case R_HALT:
+                Stop(i, LANE_OK);
+                break;
+            case R_BEGIN:
+                Stop(i, LANE_MANY_BEGIN);
+                break;
+            default:
+                Stop(i, LANE_WRONG_COMMAND);
+        }
+    }
+
+    /// Conditions of the fused jumps are known only now
+    if(cur->op >= R_CJE && cur->op <= R_CJAE)
+        for(size_t i = 0; i < BATCH_WIDTH; ++i)
+        {
+            bool is_zero = ZF[i] != 0;
+            bool is_above = above[i] != 0;
+            switch(cur->op)
+            {
+                case R_CJE:  taken[i] = is_zero;               break;
+                case R_CJNE: taken[i] = !is_zero;              break;
+                case R_CJB:  taken[i] = !is_above;             break;
+                case R_CJBE: taken[i] = !is_above || is_zero;  break;
+                case R_CJA:  taken[i] = is_above;              break;
+                case R_CJAE: taken[i] = is_above || is_zero;   break;
+            }
+        }
+}
+
+//-------------------------------------------------------------------
+//! Function "Run" executes lanes [first, first + BATCH_WIDTH)
+//!
+//!@param [in] first Index of the first lane in BatchLanes
+//!
+//!@note Missing lanes at the end of the batch are never started
+//-------------------------------------------------------------------
+void BatchGroup::Run(size_t first)
+{
+    for(size_t i = 0; i < program->frame_size; ++i)
+        for(size_t j = 0; j < BATCH_WIDTH; ++j)
+            frame[i][j] = program->frame[i];
+    ZF = BatchMask{};
+    above = BatchMask{};
+    for(size_t i = 0; i < BATCH_WIDTH; ++i)
+    {
+        lane[i] = first + i;
+        running[i] = (first + i < lanes->number);
+        pos[i] = program->entry;
+        read[i] = 0;
+        if(running[i])
+        {
+            lanes->output_counts[lane[i]] = 0;
+            lanes->errors[lane[i]] = LANE_OK;
+        }
+    }
+
+    while(true)
+    {
+        /// The lowest position goes first, so the lanes meet again after branches
+        size_t cur_pos = program->number_of_codes + 1;
+        for(size_t i = 0; i < BATCH_WIDTH; ++i)
+            if(running[i] && pos[i] < cur_pos)
+                cur_pos = pos[i];
+        if(cur_pos > program->number_of_codes)
+            return;
+
+        BatchMask mask = {};
+        for(size_t i = 0; i < BATCH_WIDTH; ++i)
+            mask[i] = (running[i] && pos[i] == cur_pos) ? -1 : 0;
+
+        const RegInstr* cur = &program->code[cur_pos];
+        bool taken[BATCH_WIDTH] = {};
+        BatchMask cond = {};
+        switch(cur->op)
+        {
+            case R_COPY:
+                BatchBlend(mask, frame[cur->a], &frame[cur->dst]);
+                break;
+            case R_ADD:
+                BatchBlend(mask, frame[cur->a] + frame[cur->b], &frame[cur->dst]);
+                SetFlags(mask, frame[cur->dst]);
+                break;
+            case R_SUB:
+                BatchBlend(mask, frame[cur->a] - frame[cur->b], &frame[cur->dst]);
+                SetFlags(mask, frame[cur->dst]);
+                break;
+            case R_MUL:
+                BatchBlend(mask, frame[cur->a] * frame[cur->b], &frame[cur->dst]);
+                SetFlags(mask, frame[cur->dst]);
+                break;
+            case R_DIV:
+            {
+                BatchValue b = frame[cur->b];
+                BatchMask zero = mask & (b < eps) & (b >= -eps);
+                for(size_t i = 0; i < BATCH_WIDTH; ++i)
+                    if(zero[i] != 0)
+                        Stop(i, LANE_DIV_ZERO);
+                mask &= ~zero;
+                BatchBlend(mask, frame[cur->a] / b, &frame[cur->dst]);
+                SetFlags(mask, frame[cur->dst]);
+                break;
+            }
+            case R_MOD:
+            case R_SQRT:
+            case R_ABS:
+                Scalar(cur, mask, taken);
+                for(size_t i = 0; i < BATCH_WIDTH; ++i)
+                    if(!running[i])
+                        mask[i] = 0;
+                SetFlags(mask, frame[cur->dst]);
+                break;
+            case R_JMP:
+                cond = mask;
+                break;
+            case R_JE:
+                cond = ZF;
+                break;
+            case R_JNE:
+                cond = ~ZF;
+                break;
+            case R_JB:
+                cond = ~above;
+                break;
+            case R_JBE:
+                cond = ~above | ZF;
+                break;
+            case R_JA:
+                cond = above;
+                break;
+            case R_JAE:
+                cond = above | ZF;
+                break;
+            default:
+                Scalar(cur, mask, taken);
+        }
+
+        for(size_t i = 0; i < BATCH_WIDTH; ++i)
+            if(mask[i] != 0)
+                pos[i] = (taken[i] || cond[i] != 0) ? cur->target : cur_pos + 1;
+    }
+}
@@ -0,0 +1,322 @@
+#include<cstdarg>
+#include<time.h>
+#include"compiler.h"
+#include"processor.h"
+
+/// Benchmark of the engines on generated programs.
+/// Usage: bench [scale] [repeats], scale is the number of loop iterations
+
+const size_t BENCH_STACK = 4096;      /// Stack of the processor in elements
+const size_t BENCH_DEPTH = 1024;      /// Depth of the "stack" workload
+const size_t BENCH_UNROLL = 20000;    /// Copies of the body in the "compile" source
+const size_t BENCH_OUTPUTS = 64;      /// Numbers kept by the output channel
+
+const char* const ENGINE_NAMES[] = {"switch", "threaded", "register", "jit"};
+const int NUMBER_OF_ENGINES = 4;
+
+/// Text of the program being generated
+struct Source
+{
+    char* text;
+    size_t size;
+    size_t capacity;
+};
+
+void Emit(Source* src, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+void Emit(Source* src, const char* format, ...)
+{
+    assert(src != NULL);
+
+    va_list args;
+    va_start(args, format);
+    char line[256];
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if(src->size + len + 1 > src->capacity)
+    {
+        src->capacity = 2 * (src->capacity + len + 1);
+        char* text = new char[src->capacity];
+        memcpy(text, src->text, src->size);
+        delete [] src->text;
+        src->text = text;
+    }
+    memcpy(src->text + src->size, line, len);
+    src->size += len;
+    src->text[src->size] = '\0';
+}
+
+/// Head of a loop over AX from the input down to 0, BX is the result
+void EmitLoopHead(Source* src)
+{
+    Emit(src, "begin\n    input ax\n    push 0\n    pop bx\nLOOP:\n");
+    Emit(src, "    push ax\n    push 0\n    cmp\n    jbe :DONE\n");
+}
+
+void EmitLoopTail(Source* src)
+{
+    Emit(src, "    push ax\n    push 1\n    sub\n    pop ax\n    jmp :LOOP\n");
+    Emit(src, "DONE:\n    output bx\nend\n");
+}
+
+/// Counter only
+void GenerateLoop(Source* src)
+{
+    EmitLoopHead(src);
+    EmitLoopTail(src);
+}
+
+/// Three ways through the body by AX % 3
+void GenerateBranches(Source* src)
+{
+    EmitLoopHead(src);
+    Emit(src, "    push ax\n    push 3\n    mod\n    pop cx\n");
+    Emit(src, "    push cx\n    push 0\n    cmp\n    je :ZERO\n");
+    Emit(src, "    push cx\n    push 1\n    cmp\n    je :ONE\n");
+    Emit(src, "    push bx\n    push 2\n    add\n    pop bx\n    jmp :NEXT\n");
+    Emit(src, "ZERO:\n    push bx\n    push 1\n    add\n    pop bx\n    jmp :NEXT\n");
+    Emit(src, "ONE:\n    push bx\n    push 3\n    sub\n    pop bx\n");
+    Emit(src, "NEXT:\n");
+    EmitLoopTail(src);
+}
+
+/// Long chain of the stack arithmetic
+void EmitChain(Source* src)
+{
+    Emit(src, "    push ax\n    push 3\n    mul\n    push 7\n    add\n    push 2\n    div\n");
+    Emit(src, "    push bx\n    add\n    push 0.5\n    mul\n    pop bx\n");
+}
+
+void GenerateArithmetic(Source* src)
+{
+    EmitLoopHead(src);
+    for(int i = 0; i < 8; ++i)
+        EmitChain(src);
+    EmitLoopTail(src);
+}
+
+/// BENCH_DEPTH numbers on the stack and back
+void GenerateStack(Source* src)
+{
+    EmitLoopHead(src);
+    for(size_t i = 0; i < BENCH_DEPTH; ++i)
+        Emit(src, "    push ax\n");
+    for(size_t i = 1; i < BENCH_DEPTH; ++i)
+        Emit(src, "    add\n");
+    Emit(src, "    pop bx\n");
+    EmitLoopTail(src);
+}
+
+/// OUTPUT on every iteration
+void GenerateOutput(Source* src)
+{
+    EmitLoopHead(src);
+    Emit(src, "    output ax\n");
+    EmitLoopTail(src);
+}
+
+/// Big straight program for the compiler, it is not run
+void GenerateCompile(Source* src)
+{
+    EmitLoopHead(src);
+    for(size_t i = 0; i < BENCH_UNROLL; ++i)
+        EmitChain(src);
+    EmitLoopTail(src);
+}
+
+struct Workload
+{
+    const char* name;
+    void (*generate)(Source* src);
+    double scale;   /// Part of the iterations, long bodies take less
+};
+
+const Workload WORKLOADS[] =
+{
+    {"loop",       GenerateLoop,       1},
+    {"branches",   GenerateBranches,   0.5},
+    {"arithmetic", GenerateArithmetic, 0.1},
+    {"stack",      GenerateStack,      0.002},
+    {"output",     GenerateOutput,     0.5},
+};
+const size_t NUMBER_OF_WORKLOADS = sizeof(WORKLOADS) / sizeof(WORKLOADS[0]);
+
+double Seconds()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/// Times of the repetitions
+struct Timing
+{
+    double min;
+    double median;
+    double mean;
+    double deviation;
+};
+
+Timing Summarize(double* times, size_t number)
+{
+    assert(times != NULL && number != 0);
+
+    /// Insertion sort, there are few repetitions
+    for(size_t i = 1; i < number; ++i)
+        for(size_t j = i; j > 0 && times[j] < times[j - 1]; --j)
+        {
+            double tmp = times[j];
+            times[j] = times[j - 1];
+            times[j - 1] = tmp;
+        }
+
+    Timing res = {};
+    res.min = times[0];
+    res.median = (number % 2 == 1) ? times[number / 2] : (times[number / 2 - 1] + times[number / 2]) / 2;
+    for(size_t i = 0; i < number; ++i)
+        res.mean += times[i] / number;
+    for(size_t i = 0; i < number; ++i)
+        res.deviation += (times[i] - res.mean) * (times[i] - res.mean) / number;
+    res.deviation = sqrt(res.deviation);
+    return res;
+}
+
+size_t CountTokens(const Source* src)
+{
+    Lexer lexer(src->text, src->size);
+    Token token = {};
+    size_t number = 0;
+    while(lexer.Next(&token))
+        ++number;
+    return number;
+}
+
+void WriteSource(const Source* src, const char* file)
+{
+    FILE* out = fopen(file, "w");
+    if(out == NULL)
+    {
+        printf("Can't open %s\n", file);
+        exit(1);
+    }
+    fwrite(src->text, 1, src->size, out);
+    fclose(out);
+}
+
+//-------------------------------------------------------------------
+//! Function "BenchCompile" measures Compiler::Compile on a big source
+//!
+//!@param [in] repeats Number of measured compilations after the warm-up
+//!
+//-------------------------------------------------------------------
+void BenchCompile(size_t repeats)
+{
+    Source src = {};
+    GenerateCompile(&src);
+    size_t tokens = CountTokens(&src);
+    WriteSource(&src, "bench_compile.txt");
+
+    Compiler compiler;
+    compiler.Compile("bench_compile.txt", "bench_compile.o");
+    double* times = new double[repeats];
+    for(size_t i = 0; i < repeats; ++i)
+    {
+        double start = Seconds();
+        compiler.Compile("bench_compile.txt", "bench_compile.o");
+        times[i] = Seconds() - start;
+    }
+    Timing timing = Summarize(times, repeats);
+    printf("compile: %zu tokens, median %.3f ms (min %.3f, sd %.3f), %.2f M tokens/s\n\n",
+           tokens, timing.median * 1e3, timing.min * 1e3, timing.deviation * 1e3,
+           tokens / timing.median * 1e-6);
+
+    unlink("bench_compile.txt");
+    unlink("bench_compile.o");
+    delete [] times;
+    delete [] src.text;
+}
+
+//-------------------------------------------------------------------
+//! Function "BenchWorkload" runs one program on every engine
+//!
+//!@param [in] work Workload to generate
+//!@param [in] scale Number of iterations of the "loop" workload
+//!@param [in] repeats Number of measured runs after the warm-up
+//!
+//!@note Commands are counted once by the profiler, the measured runs are not watched.
+//!      The warm-up is a whole Processor::Run, it builds the register form and the native code
+//-------------------------------------------------------------------
+void BenchWorkload(const Workload* work, double scale, size_t repeats)
+{
+    assert(work != NULL);
+
+    Source src = {};
+    work->generate(&src);
+    char source_file[64];
+    char object_file[64];
+    snprintf(source_file, sizeof(source_file), "bench_%s.txt", work->name);
+    snprintf(object_file, sizeof(object_file), "bench_%s.o", work->name);
+    WriteSource(&src, source_file);
+
+    Compiler compiler;
+    compiler.Compile(source_file, object_file);
+
+    double iterations = floor(scale * work->scale) + 1;
+    double outputs[BENCH_OUTPUTS];
+    SpanChannel channel;
+    Processor proc(BENCH_STACK);
+    proc.SetChannel(&channel);
+
+    Profiler counter(NULL);
+    proc.SetProfiler(&counter);
+    channel.Set(&iterations, 1, outputs, BENCH_OUTPUTS);
+    proc.Run(object_file);
+    proc.SetProfiler(NULL);
+    uint64_t commands = counter.Total();
+    double expected = outputs[0];
+    printf("%s: %.0f iterations, %llu commands\n", work->name, iterations, (unsigned long long)commands);
+
+    double* times = new double[repeats];
+    for(int engine = 0; engine < NUMBER_OF_ENGINES; ++engine)
+    {
+        channel.Set(&iterations, 1, outputs, BENCH_OUTPUTS);
+        proc.Run(object_file, (Engine)engine);
+        for(size_t i = 0; i < repeats; ++i)
+        {
+            channel.Set(&iterations, 1, outputs, BENCH_OUTPUTS);
+            double start = Seconds();
+            proc.Execute((Engine)engine);
+            times[i] = Seconds() - start;
+        }
+        if(channel.Written() == 0 || outputs[0] != expected)
+            printf("    %-9s wrong result\n", ENGINE_NAMES[engine]);
+
+        Timing timing = Summarize(times, repeats);
+        printf("    %-9s median %9.3f ms (min %9.3f, sd %7.3f)  %8.1f M commands/s  %6.2f ns/command\n",
+               ENGINE_NAMES[engine], timing.median * 1e3, timing.min * 1e3, timing.deviation * 1e3,
+               commands / timing.median * 1e-6, timing.median * 1e9 / commands);
+    }
+    printf("\n");
+
+    unlink(source_file);
+    unlink(object_file);
+    delete [] times;
+    delete [] src.text;
+}
+
+int main(int argc, char** argv)
+{
+    double scale = (argc > 1) ? atof(argv[1]) : 1e6;
+    size_t repeats = (argc > 2) ? atoi(argv[2]) : 5;
+    if(scale < 1 || repeats == 0)
+    {
+        printf("Usage: %s [scale] [repeats]\n", argv[0]);
+        return 1;
+    }
+
+    BenchCompile(repeats);
+    for(size_t i = 0; i < NUMBER_OF_WORKLOADS; ++i)
+        BenchWorkload(&WORKLOADS[i], scale, repeats);
+    return 0;
+}
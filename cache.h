@@ -0,0 +1,127 @@
+#pragma once
+
+#include<cerrno>
+#include"compiler.h"
+
+/// Compiled programs in a local directory.
+/// Every object file is named by the hash of the source, the compiler version
+/// and the options, so a changed source or compiler never finds a stale file.
+/// Lines and labels are kept next to it in the debug file (see Program::SaveDebugInfo)
+class CompileCache
+{
+    private:
+        char* directory;
+        size_t hits;
+        size_t misses;
+
+        uint64_t Key(const Compiler* compiler, const char* source, size_t size);
+        char* EntryName(uint64_t key, const char* suffix);
+        void Store(uint64_t key, const char* suffix, const Program* program, bool debug);
+
+    public:
+        CompileCache(const char* dir = ".vmcache");
+        size_t CompileSource(Compiler* compiler, const char* source, size_t size, Program* program);
+        size_t CompileFile(Compiler* compiler, const char* in_file, Program* program);
+        size_t Hits() const { return hits; }
+        size_t Misses() const { return misses; }
+        ~CompileCache()
+        {
+            delete [] directory;
+        }
+};
+
+///@note The directory is created if there is no such one
+CompileCache::CompileCache(const char* dir)
+{
+    assert(dir != NULL);
+
+    directory = new char[strlen(dir) + 1];
+    strcpy(directory, dir);
+    hits = 0;
+    misses = 0;
+    if(mkdir(directory, 0755) != 0 && errno != EEXIST)
+    {
+        printf("Can't create %s\n", directory);
+        exit(1);
+    }
+}
+
+uint64_t CompileCache::Key(const Compiler* compiler, const char* source, size_t size)
+{
+    uint32_t versions[3] = {COMPILER_VERSION, OBJECT_VERSION, (uint32_t)compiler->Passes()};
+    uint64_t key = Checksum(versions, sizeof(versions));
+    return Checksum(source, size, key);
+}
+
+///@return Name of the file in the directory, must be deleted with delete []
+char* CompileCache::EntryName(uint64_t key, const char* suffix)
+{
+    size_t len = strlen(directory) + 64;
+    char* name = new char[len];
+    snprintf(name, len, "%s/%016llx%s", directory, (unsigned long long)key, suffix);
+    return name;
+}
+
+///@note Other processes may read the entry while it is written, it appears whole by rename
+void CompileCache::Store(uint64_t key, const char* suffix, const Program* program, bool debug)
+{
+    char* name = EntryName(key, suffix);
+    char temp_suffix[32];
+    snprintf(temp_suffix, sizeof(temp_suffix), "%s.%d.tmp", suffix, (int)getpid());
+    char* temp = EntryName(key, temp_suffix);
+    if(debug)
+        program->SaveDebugInfo(temp);
+    else
+        program->Save(temp);
+    if(rename(temp, name) != 0)
+        unlink(temp);
+    delete [] temp;
+    delete [] name;
+}
+
+//-------------------------------------------------------------------
+//! Function "CompileSource" takes the program from the cache
+//! or compiles it and keeps it there
+//!
+//!@param [in] compiler Compiler for the misses, its options are a part of the key
+//!@param [in] source Text of the program
+//!@param [in] size Number of bytes in the text
+//!
+//!@param [out] program Compiled program
+//!
+//!@return Number of commands
+//!
+//-------------------------------------------------------------------
+size_t CompileCache::CompileSource(Compiler* compiler, const char* source, size_t size, Program* program)
+{
+    assert(compiler != NULL);
+    assert(program != NULL);
+
+    uint64_t key = Key(compiler, source, size);
+    char* name = EntryName(key, ".o");
+    char* debug_name = EntryName(key, ".dbg");
+    bool found = program->Load(name) && program->LoadDebugInfo(debug_name);
+    delete [] debug_name;
+    delete [] name;
+    if(found)
+    {
+        ++hits;
+        return program->Size();
+    }
+
+    /// The debug file goes first, so the object file is never found without it
+    ++misses;
+    size_t res = compiler->CompileSource(source, size, program);
+    Store(key, ".dbg", program, true);
+    Store(key, ".o", program, false);
+    return res;
+}
+
+size_t CompileCache::CompileFile(Compiler* compiler, const char* in_file, Program* program)
+{
+    size_t size = 0;
+    const char* text = MapFile(in_file, &size);
+    size_t res = CompileSource(compiler, text, size, program);
+    munmap((void*)text, size);
+    return res;
+}
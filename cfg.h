@@ -0,0 +1,603 @@
+#pragma once
+
+#include"functions.h"
+
+/// Longest block that is copied in place of the jump to it
+const size_t BLOCK_COPY_LIMIT = 4;
+
+/// Index of no block
+const size_t NO_BLOCK = (size_t)-1;
+
+/// How a basic block ends
+enum BlockExit
+{
+    EXIT_FALL = 0,   /// to next without a command
+    EXIT_JUMP = 1,   /// JMP to taken
+    EXIT_COND = 2,   /// Jcc or CJcc to taken, otherwise to next
+    EXIT_STOP = 3,   /// END or BEGIN
+};
+
+struct Block
+{
+    size_t start;   /// First command of the body
+    size_t end;     /// After the last command of the body, the exit command is not in the body
+    size_t last;    /// Exit command
+    int exit;       /// BlockExit
+    size_t taken;   /// Block of the jump target
+    size_t next;    /// Block of the way without the jump
+    size_t copy;    /// Block whose body and exit follow the body, NO_BLOCK if none
+    int depth;      /// Number of loops around the block
+};
+
+///@return bits of the signs of the flags (below, equal, above) on which the jump is taken
+int SignSet(int code)
+{
+    if(code >= CJE && code <= CJAE)
+        code = code - CJE + JE;
+    switch(code)
+    {
+        case JE:
+            return 2;
+        case JNE:
+            return 5;
+        case JB:
+        case JBE:
+            return 3;
+        case JA:
+            return 4;
+        default:
+            return 6;
+    }
+}
+
+///@return jump taken on the other signs, 0 if there is no such command (JAE)
+int InvertJump(int code)
+{
+    int base = (code >= CJE && code <= CJAE) ? CJE : JE;
+    switch(code - base + JE)
+    {
+        case JE:
+            return base - JE + JNE;
+        case JNE:
+            return base - JE + JE;
+        case JB:
+        case JBE:
+            return base - JE + JA;
+        case JA:
+            return base - JE + JBE;
+        default:
+            return 0;
+    }
+}
+
+/// Control flow graph of the compiled program.
+/// Blocks are laid out in chains where the way that stays in the loops falls through,
+/// the program is written again in this order
+class FlowGraph
+{
+    private:
+        const Instruction* instrs;
+        size_t number_of_commands;
+        size_t entry;               /// First command after BEGIN
+
+        Block* blocks;
+        size_t number_of_blocks;    /// Block number_of_blocks stands for the end of the program
+        size_t* block_of;           /// Block of every command that starts one
+        size_t* order;              /// Placed blocks
+        size_t order_size;
+        bool* placed;
+
+        size_t Forward(size_t block, int signs);
+        size_t Successors(size_t block, size_t* next);
+        void LoopDepths(const bool* reached);
+        size_t BodySize(size_t block);
+        size_t ExitSize(size_t block, size_t after);
+        size_t Choose(size_t block);
+        Instruction JumpTo(int code, const Instruction* proto, size_t address);
+        size_t EmitBody(size_t block, Instruction* code, size_t* code_lines, const size_t* lines, size_t pos);
+
+    public:
+        FlowGraph()
+        {
+            instrs = NULL;
+            number_of_commands = 0;
+            entry = 0;
+            blocks = NULL;
+            number_of_blocks = 0;
+            block_of = NULL;
+            order = NULL;
+            order_size = 0;
+            placed = NULL;
+        }
+        bool Build(const Instruction* commands, size_t number, size_t begin);
+        void Thread();
+        void Place();
+        size_t Emit(const size_t* lines, Instruction** code, size_t** code_lines, size_t* new_index);
+        ~FlowGraph()
+        {
+            delete [] blocks;
+            delete [] block_of;
+            delete [] order;
+            delete [] placed;
+        }
+};
+
+//-------------------------------------------------------------------
+//! Function "Build" splits the commands into basic blocks
+//!
+//!@param [in] commands Commands of the program, command begin - 1 is BEGIN
+//!@param [in] number Number of commands
+//!@param [in] begin First command after BEGIN
+//!
+//!@return false, if there is nothing to run
+//!
+//-------------------------------------------------------------------
+bool FlowGraph::Build(const Instruction* commands, size_t number, size_t begin)
+{
+    assert(commands != NULL);
+
+    instrs = commands;
+    number_of_commands = number;
+    entry = begin;
+    if(entry == 0 || entry >= number_of_commands)
+        return false;
+
+    bool* leader = new bool[number_of_commands + 1]();
+    leader[0] = true;
+    leader[entry] = true;
+    for(size_t i = 0; i < number_of_commands; ++i)
+    {
+        int code = instrs[i].cmd_code;
+        if(IsJump(code))
+            leader[instrs[i].address] = true;
+        if(IsJump(code) || code == END || code == BEGIN)
+            leader[i + 1] = true;
+    }
+
+    block_of = new size_t[number_of_commands + 1];
+    number_of_blocks = 0;
+    for(size_t i = 0; i < number_of_commands; ++i)
+        block_of[i] = leader[i] ? number_of_blocks++ : NO_BLOCK;
+    block_of[number_of_commands] = number_of_blocks;
+
+    blocks = new Block[number_of_blocks + 1]();
+    for(size_t i = 0; i < number_of_commands; ++i)
+    {
+        if(!leader[i])
+            continue;
+        size_t span_end = i + 1;
+        while(span_end < number_of_commands && !leader[span_end])
+            ++span_end;
+
+        Block* cur = &blocks[block_of[i]];
+        const Instruction* last = &instrs[span_end - 1];
+        cur->start = i;
+        cur->end = span_end - 1;
+        cur->last = span_end - 1;
+        cur->taken = NO_BLOCK;
+        cur->next = block_of[span_end];
+        cur->copy = NO_BLOCK;
+        if(last->cmd_code == JMP)
+        {
+            cur->exit = EXIT_JUMP;
+            cur->taken = block_of[last->address];
+            cur->next = NO_BLOCK;
+        }
+        else if(IsJump(last->cmd_code))
+        {
+            cur->exit = EXIT_COND;
+            cur->taken = block_of[last->address];
+        }
+        else if(last->cmd_code == END || last->cmd_code == BEGIN)
+        {
+            cur->exit = EXIT_STOP;
+            cur->next = NO_BLOCK;
+        }
+        else
+        {
+            cur->exit = EXIT_FALL;
+            cur->end = span_end;
+        }
+    }
+    delete [] leader;
+
+    order = new size_t[number_of_blocks];
+    placed = new bool[number_of_blocks + 1]();
+    order_size = 0;
+    return true;
+}
+
+///@return number of the blocks that may run after the block (at most 2)
+size_t FlowGraph::Successors(size_t block, size_t* next)
+{
+    const Block* cur = &blocks[block];
+    switch(cur->exit)
+    {
+        case EXIT_FALL:
+            next[0] = cur->next;
+            return 1;
+        case EXIT_JUMP:
+            next[0] = cur->taken;
+            return 1;
+        case EXIT_COND:
+            next[0] = cur->next;
+            next[1] = cur->taken;
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+//-------------------------------------------------------------------
+//! Function "Forward" skips the blocks that only jump further
+//!
+//!@param [in] block Target of the way
+//!@param [in] signs Signs of the flags possible on the way (see SignSet), 7 if unknown
+//!
+//!@return The block the way really leads to
+//!
+//!@note Jcc without commands before it is decided by the signs,
+//!      the flags are the same as on the way to it
+//-------------------------------------------------------------------
+size_t FlowGraph::Forward(size_t block, int signs)
+{
+    for(size_t steps = 0; steps < number_of_blocks && block != number_of_blocks; ++steps)
+    {
+        const Block* cur = &blocks[block];
+        if(cur->start != cur->end)
+            break;
+        int code = instrs[cur->last].cmd_code;
+        if(cur->exit == EXIT_JUMP)
+            block = cur->taken;
+        else if(cur->exit == EXIT_COND && code >= JE && code <= JAE && (signs & ~SignSet(code)) == 0)
+            block = cur->taken;
+        else if(cur->exit == EXIT_COND && code >= JE && code <= JAE && (signs & SignSet(code)) == 0)
+            block = cur->next;
+        else
+            break;
+    }
+    return block;
+}
+
+///@note Jumps to jumps lead to their targets, Jcc to the next block becomes nothing
+void FlowGraph::Thread()
+{
+    for(size_t i = 0; i < number_of_blocks; ++i)
+    {
+        Block* cur = &blocks[i];
+        int code = instrs[cur->last].cmd_code;
+        if(cur->exit == EXIT_FALL)
+            cur->next = Forward(cur->next, 7);
+        else if(cur->exit == EXIT_JUMP)
+            cur->taken = Forward(cur->taken, 7);
+        else if(cur->exit == EXIT_COND)
+        {
+            int signs = SignSet(code);
+            cur->taken = Forward(cur->taken, signs);
+            cur->next = Forward(cur->next, 7 & ~signs);
+            if(cur->taken == cur->next && code >= JE && code <= JAE)
+                cur->exit = EXIT_FALL;
+        }
+    }
+}
+
+///@note A loop is the header and the blocks that reach its back edge without the header
+void FlowGraph::LoopDepths(const bool* reached)
+{
+    /// Predecessors in one array
+    size_t* first_pred = new size_t[number_of_blocks + 2]();
+    size_t next[2];
+    for(size_t i = 0; i < number_of_blocks; ++i)
+        if(reached[i])
+            for(size_t j = 0, n = Successors(i, next); j < n; ++j)
+                ++first_pred[next[j] + 1];
+    for(size_t i = 0; i <= number_of_blocks; ++i)
+        first_pred[i + 1] += first_pred[i];
+    size_t* preds = new size_t[first_pred[number_of_blocks + 1] + 1];
+    size_t* filled = new size_t[number_of_blocks + 1]();
+    for(size_t i = 0; i < number_of_blocks; ++i)
+        if(reached[i])
+            for(size_t j = 0, n = Successors(i, next); j < n; ++j)
+                preds[first_pred[next[j]] + filled[next[j]]++] = i;
+
+    /// Back edges lead to the blocks on the stack of the depth-first search
+    char* state = new char[number_of_blocks + 1]();
+    size_t* stack = new size_t[number_of_blocks + 1];
+    size_t* edge = new size_t[number_of_blocks + 1];
+    size_t* mark = new size_t[number_of_blocks + 1];
+    size_t* work = new size_t[number_of_blocks + 1];
+    for(size_t i = 0; i <= number_of_blocks; ++i)
+        mark[i] = NO_BLOCK;
+
+    size_t stack_size = 0;
+    stack[stack_size] = block_of[entry];
+    edge[stack_size++] = 0;
+    state[block_of[entry]] = 1;
+    while(stack_size > 0)
+    {
+        size_t cur = stack[stack_size - 1];
+        size_t n = Successors(cur, next);
+        if(edge[stack_size - 1] == n)
+        {
+            state[cur] = 2;
+            --stack_size;
+            continue;
+        }
+        size_t to = next[edge[stack_size - 1]++];
+        if(to == number_of_blocks)
+            continue;
+        if(state[to] == 0)
+        {
+            state[to] = 1;
+            stack[stack_size] = to;
+            edge[stack_size++] = 0;
+            continue;
+        }
+        if(state[to] != 1)
+            continue;
+
+        /// Back edge cur -> to, blocks of the loop are counted once for every header
+        size_t work_size = 0;
+        if(mark[to] != to)
+        {
+            mark[to] = to;
+            ++blocks[to].depth;
+        }
+        if(mark[cur] != to)
+        {
+            mark[cur] = to;
+            ++blocks[cur].depth;
+            work[work_size++] = cur;
+        }
+        while(work_size > 0)
+        {
+            size_t b = work[--work_size];
+            for(size_t p = first_pred[b]; p < first_pred[b + 1]; ++p)
+                if(mark[preds[p]] != to)
+                {
+                    mark[preds[p]] = to;
+                    ++blocks[preds[p]].depth;
+                    work[work_size++] = preds[p];
+                }
+        }
+    }
+
+    delete [] work;
+    delete [] mark;
+    delete [] edge;
+    delete [] stack;
+    delete [] state;
+    delete [] filled;
+    delete [] preds;
+    delete [] first_pred;
+}
+
+///@return number of commands in the body with the copies
+size_t FlowGraph::BodySize(size_t block)
+{
+    size_t size = 0;
+    for(; block != NO_BLOCK; block = blocks[block].copy)
+        size += blocks[block].end - blocks[block].start;
+    return size;
+}
+
+//-------------------------------------------------------------------
+//! Function "Choose" takes the block to put after the block
+//!
+//!@return Not placed successor, the one deeper in the loops first,
+//!        NO_BLOCK if there is no such one
+//!
+//!@note The way without the jump is kept on a tie and when the jump can't be inverted
+//-------------------------------------------------------------------
+size_t FlowGraph::Choose(size_t block)
+{
+    const Block* cur = &blocks[block];
+    size_t next[2];
+    size_t number_of_next = Successors(block, next);
+    size_t res = NO_BLOCK;
+    for(size_t j = 0; j < number_of_next; ++j)
+    {
+        if(next[j] == number_of_blocks || placed[next[j]])
+            continue;
+        if(res == NO_BLOCK)
+            res = next[j];
+        else if(blocks[next[j]].depth > blocks[res].depth && InvertJump(instrs[cur->last].cmd_code) != 0)
+            res = next[j];
+    }
+    return res;
+}
+
+//-------------------------------------------------------------------
+//! Function "Place" puts the blocks in chains of fall-through ways
+//!
+//!@note A chain that would jump to a placed short block ending with
+//!      a condition or END takes its copy (the loop test goes to the bottom).
+//!      New chains start from the first block of the source not placed yet
+//-------------------------------------------------------------------
+void FlowGraph::Place()
+{
+    bool* reached = new bool[number_of_blocks + 1]();
+    size_t* work = new size_t[number_of_blocks + 1];
+    size_t work_size = 0;
+    size_t next[2];
+    reached[block_of[entry]] = true;
+    work[work_size++] = block_of[entry];
+    while(work_size > 0)
+    {
+        size_t cur = work[--work_size];
+        for(size_t j = 0, n = Successors(cur, next); j < n; ++j)
+            if(!reached[next[j]])
+            {
+                reached[next[j]] = true;
+                work[work_size++] = next[j];
+            }
+    }
+    LoopDepths(reached);
+
+    size_t cur = block_of[entry];
+    size_t scan = 0;
+    while(cur != NO_BLOCK)
+    {
+        placed[cur] = true;
+        order[order_size++] = cur;
+
+        Block* b = &blocks[cur];
+        size_t target = (b->exit == EXIT_JUMP) ? b->taken : b->next;
+        if((b->exit == EXIT_JUMP || b->exit == EXIT_FALL) && target != number_of_blocks && placed[target]
+           && (blocks[target].exit == EXIT_COND || blocks[target].exit == EXIT_STOP)
+           && BodySize(target) + 1 <= BLOCK_COPY_LIMIT)
+        {
+            const Block* copy = &blocks[target];
+            b->copy = target;
+            b->exit = copy->exit;
+            b->last = copy->last;
+            b->taken = copy->taken;
+            b->next = copy->next;
+        }
+
+        cur = Choose(cur);
+        while(cur == NO_BLOCK && scan < number_of_blocks)
+        {
+            if(reached[scan] && !placed[scan])
+                cur = scan;
+            ++scan;
+        }
+    }
+    delete [] work;
+    delete [] reached;
+}
+
+///@return number of exit commands of the block followed by the block after
+size_t FlowGraph::ExitSize(size_t block, size_t after)
+{
+    const Block* cur = &blocks[block];
+    switch(cur->exit)
+    {
+        case EXIT_FALL:
+            return (cur->next == after) ? 0 : 1;
+        case EXIT_JUMP:
+            return (cur->taken == after) ? 0 : 1;
+        case EXIT_COND:
+            if(cur->next == after || (cur->taken == after && InvertJump(instrs[cur->last].cmd_code) != 0))
+                return 1;
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+Instruction FlowGraph::JumpTo(int code, const Instruction* proto, size_t address)
+{
+    Instruction res = Instruction();
+    if(proto != NULL)
+        res = *proto;
+    res.cmd_flag = CMD;
+    res.cmd_code = code;
+    if(proto == NULL)
+        res.arg_flag = ADDRESS;
+    res.address = address;
+    return res;
+}
+
+///@return position after the body and its copies
+size_t FlowGraph::EmitBody(size_t block, Instruction* code, size_t* code_lines, const size_t* lines, size_t pos)
+{
+    for(; block != NO_BLOCK; block = blocks[block].copy)
+        for(size_t i = blocks[block].start; i < blocks[block].end; ++i)
+        {
+            code[pos] = instrs[i];
+            code_lines[pos++] = lines[i];
+        }
+    return pos;
+}
+
+//-------------------------------------------------------------------
+//! Function "Emit" writes the commands in the order of the blocks
+//!
+//!@param [in] lines Source line of every command
+//!
+//!@param [out] code New commands: BEGIN, then the chains, must be deleted with delete []
+//!@param [out] code_lines Lines of the new commands, must be deleted with delete []
+//!@param [out] new_index Position of every old command (number_of_commands + 1 elements),
+//!                       the end of the program for the commands that are gone
+//!
+//!@return Number of new commands
+//!
+//-------------------------------------------------------------------
+size_t FlowGraph::Emit(const size_t* lines, Instruction** code, size_t** code_lines, size_t* new_index)
+{
+    assert(lines != NULL);
+    assert(code != NULL && code_lines != NULL && new_index != NULL);
+
+    /// Positions of the blocks, the first command is BEGIN
+    size_t* position = new size_t[number_of_blocks + 1];
+    size_t size = 1;
+    for(size_t k = 0; k < order_size; ++k)
+    {
+        size_t after = (k + 1 < order_size) ? order[k + 1] : number_of_blocks;
+        position[order[k]] = size;
+        size += BodySize(order[k]) + ExitSize(order[k], after);
+    }
+    position[number_of_blocks] = size;
+
+    *code = new Instruction[size + 1]();
+    *code_lines = new size_t[size + 1]();
+    for(size_t i = 0; i <= number_of_commands; ++i)
+        new_index[i] = size;
+    (*code)[0] = instrs[entry - 1];
+    (*code_lines)[0] = lines[entry - 1];
+
+    size_t pos = 1;
+    for(size_t k = 0; k < order_size; ++k)
+    {
+        size_t b = order[k];
+        size_t after = (k + 1 < order_size) ? order[k + 1] : number_of_blocks;
+        const Block* cur = &blocks[b];
+        new_index[cur->start] = pos;
+        for(size_t i = cur->start; i < cur->end; ++i)
+            new_index[i] = pos + (i - cur->start);
+        pos = EmitBody(b, *code, *code_lines, lines, pos);
+
+        const Instruction* last = &instrs[cur->last];
+        size_t line = lines[cur->last];
+        switch(cur->exit)
+        {
+            case EXIT_FALL:
+                if(cur->next != after)
+                {
+                    (*code)[pos] = JumpTo(JMP, NULL, position[cur->next]);
+                    (*code_lines)[pos++] = line;
+                }
+                break;
+            case EXIT_JUMP:
+                if(cur->taken != after)
+                {
+                    (*code)[pos] = JumpTo(JMP, last, position[cur->taken]);
+                    (*code_lines)[pos++] = line;
+                }
+                break;
+            case EXIT_COND:
+            {
+                int inverse = InvertJump(last->cmd_code);
+                if(cur->next == after)
+                    (*code)[pos] = JumpTo(last->cmd_code, last, position[cur->taken]);
+                else if(cur->taken == after && inverse != 0)
+                    (*code)[pos] = JumpTo(inverse, last, position[cur->next]);
+                else
+                {
+                    (*code)[pos] = JumpTo(last->cmd_code, last, position[cur->taken]);
+                    (*code_lines)[pos++] = line;
+                    (*code)[pos] = JumpTo(JMP, NULL, position[cur->next]);
+                }
+                (*code_lines)[pos++] = line;
+                break;
+            }
+            default:
+                (*code)[pos] = *last;
+                (*code_lines)[pos++] = line;
+        }
+    }
+    new_index[entry - 1] = 0;
+    delete [] position;
+    return size;
+}
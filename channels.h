@@ -0,0 +1,205 @@
+#pragma once
+
+#include"functions.h"
+
+/// Size of the buffers of BinaryChannel in bytes
+const size_t CHANNEL_BUFFER = 1 << 16;
+
+/// Source of INPUT numbers and place for OUTPUT numbers
+class Channel
+{
+    public:
+        ///@return false, if there are no more numbers
+        virtual bool Read(double* value) = 0;
+        virtual void Write(int reg, double value) = 0;
+        /// Called by END: the output must be complete after it
+        virtual void End() { Flush(); }
+        virtual void Flush() {}
+        virtual ~Channel() {}
+};
+
+/// Text numbers from FILE streams.
+/// Output is buffered by the stream and flushed only at END or when the buffer is full,
+/// the prompts and the END message are written only in the interactive mode
+class StreamChannel : public Channel
+{
+    private:
+        FILE* in;
+        FILE* out;
+        bool interactive;
+
+    public:
+        StreamChannel(FILE* in_stream = stdin, FILE* out_stream = stdout, bool prompts = true)
+        {
+            in = in_stream;
+            out = out_stream;
+            interactive = prompts;
+        }
+        bool Read(double* value);
+        void Write(int reg, double value);
+        void End();
+        void Flush() { fflush(out); }
+};
+
+bool StreamChannel::Read(double* value)
+{
+    assert(value != NULL);
+
+    /// The user must see the question before the answer
+    if(interactive)
+    {
+        fputs("Enter a number\n", out);
+        fflush(out);
+    }
+    return fscanf(in, "%lf", value) == 1;
+}
+
+void StreamChannel::Write(int reg, double value)
+{
+    fprintf(out, "Register %s contains %g\n", REG_NAMES[reg], value);
+}
+
+void StreamChannel::End()
+{
+    if(interactive)
+        fputs("End of the program\n", out);
+    Flush();
+}
+
+/// Numbers in memory: INPUT reads an array, OUTPUT fills another one
+class SpanChannel : public Channel
+{
+    private:
+        const double* input;
+        size_t input_size;
+        size_t input_pos;
+        double* output;
+        size_t output_capacity;
+        size_t output_size;
+
+    public:
+        SpanChannel()
+        {
+            Set(NULL, 0, NULL, 0);
+        }
+        SpanChannel(const double* in, size_t in_size, double* out, size_t out_capacity)
+        {
+            Set(in, in_size, out, out_capacity);
+        }
+        void Set(const double* in, size_t in_size, double* out, size_t out_capacity)
+        {
+            input = in;
+            input_size = in_size;
+            input_pos = 0;
+            output = out;
+            output_capacity = out_capacity;
+            output_size = 0;
+        }
+        bool Read(double* value);
+        void Write(int reg, double value);
+        /// Number of OUTPUT commands, only out_capacity numbers are kept
+        size_t Written() { return output_size; }
+};
+
+bool SpanChannel::Read(double* value)
+{
+    assert(value != NULL);
+
+    if(input_pos == input_size)
+        return false;
+    *value = input[input_pos++];
+    return true;
+}
+
+void SpanChannel::Write(int reg, double value)
+{
+    (void)reg;
+    if(output_size < output_capacity)
+        output[output_size] = value;
+    ++output_size;
+}
+
+/// Raw doubles from and to file descriptors, no text conversions
+class BinaryChannel : public Channel
+{
+    private:
+        int in;
+        int out;
+        char* in_buffer;
+        size_t in_size;
+        size_t in_pos;
+        char* out_buffer;
+        size_t out_size;
+
+    public:
+        BinaryChannel(int in_fd, int out_fd)
+        {
+            in = in_fd;
+            out = out_fd;
+            in_buffer = new char[CHANNEL_BUFFER];
+            in_size = 0;
+            in_pos = 0;
+            out_buffer = new char[CHANNEL_BUFFER];
+            out_size = 0;
+        }
+        bool Read(double* value);
+        void Write(int reg, double value);
+        void Flush();
+        ~BinaryChannel()
+        {
+            Flush();
+            delete [] in_buffer;
+            delete [] out_buffer;
+        }
+};
+
+bool BinaryChannel::Read(double* value)
+{
+    assert(value != NULL);
+
+    /// The number may be split between two reads
+    char* bytes = (char*)value;
+    for(size_t got = 0; got < sizeof(double); )
+    {
+        if(in_pos == in_size)
+        {
+            ssize_t res = read(in, in_buffer, CHANNEL_BUFFER);
+            if(res <= 0)
+                return false;
+            in_size = res;
+            in_pos = 0;
+        }
+        size_t part = sizeof(double) - got;
+        if(part > in_size - in_pos)
+            part = in_size - in_pos;
+        memcpy(bytes + got, in_buffer + in_pos, part);
+        got += part;
+        in_pos += part;
+    }
+    return true;
+}
+
+void BinaryChannel::Write(int reg, double value)
+{
+    (void)reg;
+    if(out_size + sizeof(double) > CHANNEL_BUFFER)
+        Flush();
+    memcpy(out_buffer + out_size, &value, sizeof(double));
+    out_size += sizeof(double);
+}
+
+void BinaryChannel::Flush()
+{
+    size_t done = 0;
+    while(done < out_size)
+    {
+        ssize_t res = write(out, out_buffer + done, out_size - done);
+        if(res <= 0)
+        {
+            printf("Can't write the output\n");
+            exit(1);
+        }
+        done += res;
+    }
+    out_size = 0;
+}
@@ -1,13 +1,47 @@
 #pragma once
 #include "functions.h"
-#define NOT_FOUND -1
-const int MAXLEN = 25;
+#include "keywords.h"
+#include "lexer.h"
+#include "symbols.h"
+#include "program.h"
+#include "cfg.h"
+
+/// Changes with every change of the generated code (see cache.h)
+const uint32_t COMPILER_VERSION = 4;
+
+/// Rounds of the dataflow passes, every round may open new chances for the others
+const int OPTIMIZER_ROUNDS = 8;
+
+/// Passes after the syntax analysis, every one has its own switch (see Compiler::SetPass)
+enum CompilerPass
+{
+    PASS_PEEPHOLE = 1,    /// windows of the stack commands (Peephole)
+    PASS_DATAFLOW = 2,    /// propagation, folding and dead code (Optimize)
+    PASS_LAYOUT = 4,      /// order of the basic blocks (Layout)
+    PASS_DEAD_FLAGS = 8,  /// marks of the flags nobody reads (MarkDeadFlags)
+    PASS_ALL = 15,
+};
+
+/// What the dataflow pass knows about a register
+enum Known
+{
+    KNOWN_NOTHING = 0,
+    KNOWN_CONST = 1,   /// its value is value
+    KNOWN_COPY = 2,    /// it is equal to the register reg
+};
+
+struct RegValue
+{
+    int kind; //Known
+    int reg;
+    double value;
+};
 
 class Compiler
 {
     private:
         size_t number_of_labels;
-        char** labels;
+        SymbolTable labels;
         size_t* addresses;
 
         size_t number_of_lexems;
@@ -15,27 +49,49 @@ class Compiler
 
         size_t number_of_instructions;
         Instruction* syntax;
+        size_t* lines;          /// Source line of every instruction
+        size_t begin;
+
+        int passes;             /// CompilerPass bits of the enabled passes
+        size_t peephole_removed;
+        size_t optimizer_removed;
+        size_t dead_flags;
+        size_t jumps_removed;
 
-        Flag GetFlag(char data[]);
-        double GetObject(char data[]);
-        Command GetCommand(char data[]);
-        Register GetRegister(char data[]);
-        size_t CorrectLabel(char data[]);
-        void LabelRegistrator(char** pointers);
-        void LexicAnalysis(char** pointers);
+        Flag Classify(const Token* token, double* obj);
+        void LabelRegistrator(Lexer* lexer);
+        void LexicAnalysis(Lexer* lexer);
+        [[noreturn]] void SourceError(Error err, size_t lexem_counter);
         void SyntaxAnalysis();
         int FlagCMD(size_t lexem_counter, size_t instr_counter);
         void FlagLABEL(size_t lexem_counter, size_t instr_counter);
         void CommandWithArgument(size_t lexem_counter, size_t instr_counter);
         void CommandNoArgument(size_t lexem_counter, size_t instr_counter);
         void CommandJump(size_t lexem_counter, size_t instr_counter);
-        void SyntaxToFile(const char* out_file);
+        bool IsCommand(size_t instr_counter, int code);
+        bool IsArithmetic(size_t instr_counter);
+        void RemoveInstructions(const bool* removed);
+        size_t Peephole();
+        size_t Successors(size_t instr_counter, size_t* next);
+        void JumpTargets(bool* target);
+        void FlagLiveness(bool* live);
+        bool FlagsRead(size_t instr_counter, const bool* live);
+        void TransferRegs(size_t instr_counter, RegValue* state);
+        bool RewriteRegs(size_t instr_counter, const RegValue* state, const bool* live, bool* removed);
+        size_t PropagateRegisters();
+        size_t FoldConstants();
+        size_t RemoveUnreachable();
+        size_t RemoveDeadStores();
+        size_t Optimize();
+        size_t Layout();
+        size_t MarkDeadFlags();
+        void FindBegin();
+        void Clear();
 
     public:
         Compiler()
         {
             number_of_labels = 0;
-            labels = NULL;
             addresses = NULL;
           
             number_of_lexems = 0;
@@ -43,264 +99,117 @@ class Compiler
 
             number_of_instructions = 0;
             syntax = NULL;
+            lines = NULL;
+            begin = 0;
+
+            passes = PASS_ALL;
+            peephole_removed = 0;
+            optimizer_removed = 0;
+            dead_flags = 0;
+            jumps_removed = 0;
         }
         size_t Compile(const char* in_file, const char* out_file);
+        size_t CompileFile(const char* in_file, Program* program);
+        size_t CompileSource(const char* source, size_t size, Program* program);
+        void SetPass(int pass, bool enable) { passes = enable ? (passes | pass) : (passes & ~pass); }
+        void SetPeephole(bool enable) { SetPass(PASS_PEEPHOLE, enable); }
+        size_t PeepholeRemoved() const { return peephole_removed; }
+        size_t OptimizerRemoved() const { return optimizer_removed; }
+        size_t DeadFlags() const { return dead_flags; }
+        size_t JumpsRemoved() const { return jumps_removed; }
+        bool PassEnabled(int pass) const { return (passes & pass) != 0; }
+        bool PeepholeEnabled() const { return PassEnabled(PASS_PEEPHOLE); }
+        int Passes() const { return passes; }
         ~Compiler()
         {
-            for(size_t i = 0; i < number_of_labels; ++i)
-                delete [] labels[i];
-            delete [] labels;
             //delete [] functions;
             delete [] addresses;
             delete [] lexic;
             delete [] syntax;
+            delete [] lines;
         }
 };
 
-Flag Compiler::GetFlag(char data[])
-{
-    assert(data != NULL);
-
-    int len = strlen(data);
-    for(int i = 0; i < len; ++i)
-        data[i] = toupper(data[i]);
-
-    if(strcmp(data, "PUSH") == 0)
-        return CMD;
-    if(strcmp(data, "POP") == 0)
-        return CMD;
-    if(strcmp(data, "ADD") == 0)
-        return CMD;
-    if(strcmp(data, "SUB") == 0)
-        return CMD;
-    if(strcmp(data, "MUL") == 0)
-        return CMD;
-    if(strcmp(data, "DIV") == 0)
-        return CMD;
-    if(strcmp(data, "MOD") == 0)
-        return CMD;
-    if(strcmp(data, "INPUT") == 0)
-        return CMD;
-    if(strcmp(data, "OUTPUT") == 0)
-        return CMD;
-    if(strcmp(data, "DUMP") == 0)
-        return CMD;
-    if(strcmp(data, "JMP") == 0)
-        return CMD;
-    if(strcmp(data, "BEGIN") == 0)
-        return CMD;
-    if(strcmp(data, "END") == 0)
-        return CMD;
-    if(strcmp(data, "SQRT") == 0)
-        return CMD;
-    if(strcmp(data, "TOP") == 0)
-        return CMD;
-    if(strcmp(data, "ABS") == 0)
-        return CMD;
-    if(strcmp(data, "CMP") == 0)
-        return CMD;
-    if(strcmp(data, "JE") == 0)
-        return CMD;
-    if(strcmp(data, "JNE") == 0)
-        return CMD;
-    if(strcmp(data, "JB") == 0)
-        return CMD;
-    if(strcmp(data, "JBE") == 0)
-        return CMD;
-    if(strcmp(data, "JA") == 0)
-        return CMD;
-    if(strcmp(data, "JAE") == 0)
-        return CMD;
-
-    if(strcmp(data, "AX") == 0)
-        return REG;
-    if(strcmp(data, "BX") == 0)
-        return REG;
-    if(strcmp(data, "CX") == 0)
-        return REG;
-    if(strcmp(data, "DX") == 0)
-        return REG;
-    if(strcmp(data, "SI") == 0)
-        return REG;
-    if(strcmp(data, "DI") == 0)
-        return REG;
-    if(strcmp(data, "BP") == 0)
-        return REG;
-
-    if(IsLabel(data))
-        return LABEL;
-
-    if(IsLabelArg(data))
-        return LABEL_ARG;
-
-    if(IsNumeral(data))
-        return NUM;
-    else
-        return ERR_FLAG;
-}
-
-double Compiler::GetObject(char data[])
+///@return flag of the word, its code or value is written to obj
+Flag Compiler::Classify(const Token* token, double* obj)
 {
-    switch(GetFlag(data))
+    assert(token != NULL);
+    assert(obj != NULL);
+
+    const Keyword* keyword = FindKeyword(token->start, token->len);
+    if(keyword != NULL)
     {
-        case CMD:
-            return (double)GetCommand(data);
-        case REG:
-            return (double)GetRegister(data);
-        case NUM:
-            return atof(data);
-        case LABEL:
-        case LABEL_ARG:
-            return (double)CorrectLabel(data);
-        default:
-            return 0;
+        *obj = keyword->code;
+        return keyword->flag;
     }
-}
 
-Command Compiler::GetCommand(char data[])
-{
-    assert(data != NULL);
-
-    int len = strlen(data);
-    for(int i = 0; i < len; ++i)
-        data[i] = toupper(data[i]);
-
-    if(strcmp(data, "PUSH") == 0)
-        return PUSH;
-    if(strcmp(data, "POP") == 0)
-        return POP;
-    if(strcmp(data, "ADD") == 0)
-        return ADD;
-    if(strcmp(data, "SUB") == 0)
-        return SUB;
-    if(strcmp(data, "MUL") == 0)
-        return MUL;
-    if(strcmp(data, "DIV") == 0)
-        return DIV;
-    if(strcmp(data, "MOD") == 0)
-        return MOD;
-    if(strcmp(data, "INPUT") == 0)
-        return INPUT;
-    if(strcmp(data, "OUTPUT") == 0)
-        return OUTPUT;
-    if(strcmp(data, "DUMP") == 0)
-        return DUMP;
-    if(strcmp(data, "JMP") == 0)
-        return JMP;
-    if(strcmp(data, "BEGIN") == 0)
-        return BEGIN;
-    if(strcmp(data, "END") == 0)
-        return END;
-    if(strcmp(data, "SQRT") == 0)
-        return SQRT;
-    if(strcmp(data, "TOP") == 0)
-        return TOP;
-    if(strcmp(data, "ABS") == 0)
-        return ABS;
-    if(strcmp(data, "CMP") == 0)
-        return CMP;
-    if(strcmp(data, "JE") == 0)
-        return JE;
-    if(strcmp(data, "JNE") == 0)
-        return JNE;
-    if(strcmp(data, "JB") == 0)
-        return JB;
-    if(strcmp(data, "JBE") == 0)
-        return JBE;
-    if(strcmp(data, "JA") == 0)
-        return JA;
-    if(strcmp(data, "JAE") == 0)
-        return JAE;
-    else
-        return ERR_CMD;
-}
-
-Register Compiler::GetRegister(char data[])
-{
-    assert(data != NULL);
-
-    int len = strlen(data);
-    for(int i = 0; i < len; ++i)
-        data[i] = toupper(data[i]);
-
-    if(strcmp(data, "AX") == 0)
-        return AX;
-    if(strcmp(data, "BX") == 0)
-        return BX;
-    if(strcmp(data, "CX") == 0)
-        return CX;
-    if(strcmp(data, "DX") == 0)
-        return DX;
-    if(strcmp(data, "SI") == 0)
-        return SI;
-    if(strcmp(data, "DI") == 0)
-        return DI;
-    if(strcmp(data, "BP") == 0)
-        return BP;
-    else
-        return ERR_REG;
-}
-
-size_t Compiler::CorrectLabel(char data[])
-{
-    assert(data != NULL);
-    char* res = DeleteColumn(data);
+    bool label = IsLabel(token->start, token->len);
+    if(label || IsLabelArg(token->start, token->len))
+    {
+        /// Name without the column
+        size_t index = label ? labels.Find(token->start, token->len - 1)
+                             : labels.Find(token->start + 1, token->len - 1);
+        if(index == (size_t)NOT_FOUND)
+            return ERR_FLAG;
+        *obj = (double)index;
+        return label ? LABEL : LABEL_ARG;
+    }
 
-    for(size_t i = 0; i < number_of_labels; ++i)
-        if(strcmp(res, labels[i]) == 0)
-            return i;
-    return NOT_FOUND;
+    if(IsNumeral(token->start, token->len))
+    {
+        *obj = ParseNumeral(token->start, token->len);
+        return NUM;
+    }
+    *obj = 0;
+    return ERR_FLAG;
 }
 
-void Compiler::LabelRegistrator(char** pointers)
+///@note Counts words too
+void Compiler::LabelRegistrator(Lexer* lexer)
 {
-    assert(pointers != NULL);
+    assert(lexer != NULL);
 
-    for(size_t i = 0; i < number_of_lexems; ++i)
-        if(IsLabel(pointers[i]))
-            ++number_of_labels;
-
-    labels = new char*[number_of_labels];
-    for(size_t i = 0; i < number_of_labels; ++i)
-        labels[i] = new char[MAXLEN];
+    Token token = {};
+    while(lexer->Next(&token))
+    {
+        ++number_of_lexems;
 
-    size_t label_counter = 0;
-    for(size_t i = 0; i < number_of_lexems; ++i)
-        if(IsLabel(pointers[i]))
-        {
-            char* res = DeleteColumn(pointers[i]);
-            int len = strlen(res);
-            for(int i = 0; i < len; ++i)
-                res[i] = toupper(res[i]);
-            strcpy(labels[label_counter], res);
-            ++label_counter;
-        }
+        /// Name without the column
+        if(IsLabel(token.start, token.len))
+            labels.Intern(token.start, token.len - 1);
+    }
+    number_of_labels = labels.Size();
 }
 
-void Compiler::LexicAnalysis(char** pointers)
+void Compiler::LexicAnalysis(Lexer* lexer)
 {
-    assert(pointers != NULL);
+    assert(lexer != NULL);
     lexic = new Lexem[number_of_lexems];
+    Token token = {};
     for(size_t lexem_counter = 0; lexem_counter < number_of_lexems; ++lexem_counter)
     {
-        /// Get flag of the command
-        Flag flag = GetFlag(pointers[lexem_counter]);
+        lexer->Next(&token);
+        lexic[lexem_counter].line = token.line;
+        lexic[lexem_counter].column = token.column;
+
+        /// Get flag and description of the command
+        Flag flag = Classify(&token, &lexic[lexem_counter].obj);
         if(flag == ERR_FLAG)
-            CompError(UNKNOWN, lexem_counter + 1);
+            SourceError(UNKNOWN, lexem_counter);
         lexic[lexem_counter].flag = flag;
-
-        /// Get the description of the command
-        lexic[lexem_counter].obj = GetObject(pointers[lexem_counter]);
-        //if(flag == LABEL || flag == FUNCTION)
-        if(flag == LABEL || flag == LABEL_ARG)
-            if(lexic[lexem_counter].obj == NOT_FOUND)
-                CompError(UNKNOWN, lexem_counter + 1);
     }
 }
 
+void Compiler::SourceError(Error err, size_t lexem_counter)
+{
+    CompError(err, lexic[lexem_counter].line, lexic[lexem_counter].column);
+}
+
 void Compiler::SyntaxAnalysis()
 {
-    syntax = new Instruction[number_of_lexems];
+    /// Zeroed, so the padding written to the object file is stable
+    syntax = new Instruction[number_of_lexems]();
+    lines = new size_t[number_of_lexems]();
     addresses = new size_t[number_of_labels];
     int instr_counter = 0;
     int number = 0;
@@ -310,6 +219,7 @@ void Compiler::SyntaxAnalysis()
         switch(lexic[lexem_counter].flag)
         {
             case CMD:
+                lines[instr_counter] = lexic[lexem_counter].line;
                 number = FlagCMD(lexem_counter, instr_counter);
                 lexem_counter += number;
                 break;
@@ -318,11 +228,12 @@ void Compiler::SyntaxAnalysis()
             case REG:
             case NUM:
             case LABEL_ARG:
-                CompError(WRONG_TOKEN, instr_counter + 1);
+                SourceError(WRONG_TOKEN, lexem_counter);
 
+            /// Labels take no place in the program
             case LABEL:
                 FlagLABEL(lexem_counter, instr_counter);
-                break;
+                continue;
 
             default:
                 printf("%d\n", lexic[lexem_counter].flag);
@@ -338,7 +249,8 @@ void Compiler::SyntaxAnalysis()
         {
             syntax[i].arg_flag = ADDRESS;
             int lab_num = (int)syntax[i].value;
-            syntax[i].value = addresses[lab_num];
+            syntax[i].address = addresses[lab_num];
+            syntax[i].value = 0;
         }
 }
 
@@ -391,11 +303,11 @@ void Compiler::CommandWithArgument(size_t lexem_counter, size_t instr_counter)
 {
     /// List can't end with this word
     if(lexem_counter == number_of_lexems - 1)
-        CompError(NEED_ARG, instr_counter + 1);
+        SourceError(NEED_ARG, lexem_counter);
 
     /// List can't end with this command
     if(lexem_counter == number_of_lexems - 2)
-        CompError(WRONG_END, instr_counter + 1);
+        SourceError(WRONG_END, lexem_counter);
 
     syntax[instr_counter].cmd_code = (Command)lexic[lexem_counter].obj;
 
@@ -404,19 +316,20 @@ void Compiler::CommandWithArgument(size_t lexem_counter, size_t instr_counter)
     {
     case REG:
         syntax[instr_counter].arg_flag = REG;
-        syntax[instr_counter].value = lexic[lexem_counter + 1].obj;
+        syntax[instr_counter].reg = (int)lexic[lexem_counter + 1].obj - AX;
+        syntax[instr_counter].value = 0;
         break;
 
     case NUM:
         if(lexic[lexem_counter].obj != PUSH)
-            CompError(NEED_ARG, instr_counter + 1);
+            SourceError(NEED_ARG, lexem_counter);
         syntax[instr_counter].arg_flag = NUM;
         syntax[instr_counter].value = lexic[lexem_counter + 1].obj;
         break;
 
     default:
         /// Next word must be an argument: numeral or register
-        CompError(NEED_ARG, instr_counter + 1);
+        SourceError(NEED_ARG, lexem_counter);
     }
 }
 
@@ -427,12 +340,12 @@ void Compiler::CommandNoArgument(size_t lexem_counter, size_t instr_counter)
     if(lexem_counter != number_of_lexems - 1
        && lexic[lexem_counter + 1].flag != CMD
        && lexic[lexem_counter + 1].flag != LABEL)
-       CompError(NO_ARG, instr_counter + 1);
+       SourceError(NO_ARG, lexem_counter);
 
     /// List can't end with this command
     if(lexem_counter == number_of_lexems - 1
        && lexic[lexem_counter].obj != END)
-        CompError(WRONG_END, instr_counter + 1);
+        SourceError(WRONG_END, lexem_counter);
 
     syntax[instr_counter].cmd_code = (Command)lexic[lexem_counter].obj;
     syntax[instr_counter].arg_flag = NUL;
@@ -444,22 +357,18 @@ void Compiler::CommandJump(size_t lexem_counter, size_t instr_counter)
     /// The next word must be label argument
     if(lexem_counter == number_of_lexems - 1
        || lexic[lexem_counter + 1].flag != LABEL_ARG)
-       CompError(NEED_ARG, instr_counter + 1);
+       SourceError(NEED_ARG, lexem_counter);
 
     syntax[instr_counter].cmd_code = (Command)lexic[lexem_counter].obj;
     syntax[instr_counter].arg_flag = LABEL_ARG;
     syntax[instr_counter].value = lexic[lexem_counter + 1].obj;
 }
 
+///@note Label leads to the next command
 void Compiler::FlagLABEL(size_t lexem_counter, size_t instr_counter)
 {
     int index = (int)lexic[lexem_counter].obj;
     addresses[index] = instr_counter;
-
-    syntax[instr_counter].cmd_flag = LABEL;
-    syntax[instr_counter].cmd_code = ERR_CMD;
-    syntax[instr_counter].arg_flag = NUL;
-    syntax[instr_counter].value = lexic[lexem_counter].obj;
 }
 
 void TestSyntax(Instruction* syntax, size_t num)
@@ -477,50 +386,1072 @@ void TestSyntax(Instruction* syntax, size_t num)
     return;
 }
 
-void Compiler::SyntaxToFile(const char* out_file)
+bool Compiler::IsCommand(size_t instr_counter, int code)
+{
+    return instr_counter < number_of_instructions
+           && syntax[instr_counter].cmd_flag == CMD
+           && syntax[instr_counter].cmd_code == code;
+}
+
+bool Compiler::IsArithmetic(size_t instr_counter)
+{
+    return IsCommand(instr_counter, ADD)
+           || IsCommand(instr_counter, SUB)
+           || IsCommand(instr_counter, MUL);
+}
+
+///@note Jumps to a removed instruction lead to the next kept one
+void Compiler::RemoveInstructions(const bool* removed)
 {
-    assert(out_file != NULL);
-    FILE * out = fopen(out_file, "w");
+    assert(removed != NULL);
+
+    size_t* new_index = new size_t[number_of_instructions + 1];
+    size_t kept = 0;
     for(size_t i = 0; i < number_of_instructions; ++i)
     {
-        fprintf(out, "%d", syntax[i].cmd_flag);
-        fputs(" ", out);
-        fprintf(out, "%d", syntax[i].cmd_code);
-        fputs(" ", out);
-        fprintf(out, "%d", syntax[i].arg_flag);
-        fputs(" ", out);
-        fprintf(out, "%g", syntax[i].value);
-        fputs("\n", out);
+        new_index[i] = kept;
+        if(!removed[i])
+        {
+            lines[kept] = lines[i];
+            syntax[kept++] = syntax[i];
+        }
     }
-    fclose(out);
+    new_index[number_of_instructions] = kept;
+
+    for(size_t i = 0; i < kept; ++i)
+        if(syntax[i].cmd_flag == CMD && IsJump(syntax[i].cmd_code))
+            syntax[i].address = new_index[syntax[i].address];
+    for(size_t i = 0; i < number_of_labels; ++i)
+        addresses[i] = new_index[addresses[i]];
+
+    /// Keeping the tail zeroed for the object file
+    for(size_t i = kept; i < number_of_instructions; ++i)
+        syntax[i] = Instruction();
+    number_of_instructions = kept;
+    delete [] new_index;
 }
 
-size_t Compiler::Compile(const char* in_file, const char* out_file)
+///@return number of removed instructions
+///
+///@note Rewrites data moving windows:
+///      push r1 / push n / add|sub|mul / pop r2  ->  ADDI|SUBI|MULI r2, r1, n
+///      push n / push r1 / add|mul / pop r2      ->  ADDI|MULI r2, r1, n
+///      push n / pop r                           ->  MOV r, n
+///      push r1 / pop r2                         ->  MOV r2, r1 (nothing if r1 == r2)
+///      push x / push y / cmp / jcc :L           ->  CJcc x, y, :L (x or y is a register)
+///      Only the first instruction of a window may be a jump target
+size_t Compiler::Peephole()
 {
-    /// Enter data from the file
-    char* buffer = FileToArray(in_file);
+    bool* target = new bool[number_of_instructions + 1];
+    JumpTargets(target);
+
+    bool* removed = new bool[number_of_instructions]();
+    size_t number_removed = 0;
+    size_t i = 0;
+    while(i < number_of_instructions)
+    {
+        Instruction* cur = &syntax[i];
+        Instruction* next = &syntax[i + 1];
+        if(!IsCommand(i, PUSH))
+        {
+            ++i;
+            continue;
+        }
+
+        /// push x / push y / cmp / jcc :L
+        if(IsCommand(i + 1, PUSH) && IsCommand(i + 2, CMP) && i + 3 < number_of_instructions
+           && syntax[i + 3].cmd_flag == CMD
+           && syntax[i + 3].cmd_code >= JE && syntax[i + 3].cmd_code <= JAE
+           && !(cur->arg_flag == NUM && next->arg_flag == NUM)
+           && !target[i + 1] && !target[i + 2] && !target[i + 3])
+        {
+            Instruction res = Instruction();
+            res.cmd_flag = CMD;
+            res.cmd_code = syntax[i + 3].cmd_code - JE + CJE;
+            res.address = syntax[i + 3].address;
+            if(cur->arg_flag == REG && next->arg_flag == REG)
+            {
+                res.arg_flag = REG_REG;
+                res.reg = cur->reg;
+                res.src = next->reg;
+            }
+            else if(cur->arg_flag == REG)
+            {
+                res.arg_flag = REG_NUM;
+                res.reg = cur->reg;
+                res.value = next->value;
+            }
+            else
+            {
+                res.arg_flag = NUM_REG;
+                res.value = cur->value;
+                res.src = next->reg;
+            }
+            syntax[i] = res;
+            removed[i + 1] = removed[i + 2] = removed[i + 3] = true;
+            number_removed += 3;
+            i += 4;
+            continue;
+        }
+
+        /// push x / push y / op / pop r
+        if(IsCommand(i + 1, PUSH) && IsArithmetic(i + 2) && IsCommand(i + 3, POP)
+           && !target[i + 1] && !target[i + 2] && !target[i + 3])
+        {
+            int code = syntax[i + 2].cmd_code;
+            const Instruction* reg_arg = NULL;
+            const Instruction* num_arg = NULL;
+            if(cur->arg_flag == REG && next->arg_flag == NUM)
+            {
+                reg_arg = cur;
+                num_arg = next;
+            }
+            else if(cur->arg_flag == NUM && next->arg_flag == REG && code != SUB)
+            {
+                reg_arg = next;
+                num_arg = cur;
+            }
+            if(reg_arg != NULL)
+            {
+                Instruction res = Instruction();
+                res.cmd_flag = CMD;
+                res.cmd_code = (code == ADD) ? ADDI : (code == SUB) ? SUBI : MULI;
+                res.arg_flag = NUM;
+                res.reg = syntax[i + 3].reg;
+                res.src = reg_arg->reg;
+                res.value = num_arg->value;
+                syntax[i] = res;
+                removed[i + 1] = removed[i + 2] = removed[i + 3] = true;
+                number_removed += 3;
+                i += 4;
+                continue;
+            }
+        }
+
+        /// push x / pop r
+        if(IsCommand(i + 1, POP) && !target[i + 1])
+        {
+            if(cur->arg_flag == REG && cur->reg == next->reg)
+            {
+                removed[i] = removed[i + 1] = true;
+                number_removed += 2;
+            }
+            else
+            {
+                Instruction res = Instruction();
+                res.cmd_flag = CMD;
+                res.cmd_code = MOV;
+                res.arg_flag = cur->arg_flag;
+                res.reg = next->reg;
+                res.src = cur->reg;
+                res.value = cur->value;
+                syntax[i] = res;
+                removed[i + 1] = true;
+                number_removed += 1;
+            }
+            i += 2;
+            continue;
+        }
+        ++i;
+    }
+
+    if(number_removed != 0)
+        RemoveInstructions(removed);
+    delete [] removed;
+    delete [] target;
+    return number_removed;
+}
+
+///@return number of the commands that may run after the command (at most 2),
+///        number_of_instructions stands for the end of the program
+size_t Compiler::Successors(size_t instr_counter, size_t* next)
+{
+    assert(next != NULL);
+
+    const Instruction* cur = &syntax[instr_counter];
+    if(cur->cmd_code == END || cur->cmd_code == BEGIN)
+        return 0;
+    if(cur->cmd_code == JMP)
+    {
+        next[0] = cur->address;
+        return 1;
+    }
+    next[0] = instr_counter + 1;
+    if(!IsJump(cur->cmd_code))
+        return 1;
+    next[1] = cur->address;
+    return 2;
+}
+
+///@note target must have number_of_instructions + 1 elements
+void Compiler::JumpTargets(bool* target)
+{
+    assert(target != NULL);
+
+    for(size_t i = 0; i <= number_of_instructions; ++i)
+        target[i] = false;
+    for(size_t i = 0; i < number_of_instructions; ++i)
+        if(syntax[i].cmd_flag == CMD && IsJump(syntax[i].cmd_code))
+            target[syntax[i].address] = true;
+}
+
+//-------------------------------------------------------------------
+//! Function "FlagLiveness" finds the commands before which the flags may be read
+//!
+//!@param [out] live Array of number_of_instructions + 1 elements
+//!
+//!@note Flags are live before a command if it reads them, or if it keeps them
+//!      and they are live after it on some path. The fused jumps read only their own flags
+//-------------------------------------------------------------------
+void Compiler::FlagLiveness(bool* live)
+{
+    assert(live != NULL);
+
+    for(size_t i = 0; i <= number_of_instructions; ++i)
+        live[i] = false;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(size_t i = number_of_instructions; i-- > 0; )
+        {
+            int code = syntax[i].cmd_code;
+            bool res = ReadsFlags(code);
+            if(!res && !SetsFlags(code))
+            {
+                size_t next[2];
+                size_t number_of_next = Successors(i, next);
+                for(size_t j = 0; j < number_of_next; ++j)
+                    res = res || live[next[j]];
+            }
+            if(res != live[i])
+            {
+                live[i] = res;
+                changed = true;
+            }
+        }
+    }
+}
+
+///@return true, if the flags set by the command may be read later
+bool Compiler::FlagsRead(size_t instr_counter, const bool* live)
+{
+    size_t next[2];
+    size_t number_of_next = Successors(instr_counter, next);
+    for(size_t j = 0; j < number_of_next; ++j)
+        if(live[next[j]])
+            return true;
+    return false;
+}
+
+///@return true, if the number is the same for the processors of every type
+///        and the arithmetic on such numbers is exact
+bool IsPortable(double value)
+{
+    return value == floor(value) && fabs(value) <= INT_MAX;
+}
+
+//-------------------------------------------------------------------
+//! Function "FoldCommand" computes the command on known numbers
+//!
+//!@param [in] code ADD, SUB, MUL, DIV, MOD, ABS or SQRT (one argument is up)
+//!@param [in] up Upper argument
+//!@param [in] down Lower argument
+//!
+//!@param [out] res Result
+//!
+//!@return false, if the command fails at run time or its result
+//!        depends on the type of the processor
+//!
+//-------------------------------------------------------------------
+bool FoldCommand(int code, double up, double down, double* res)
+{
+    assert(res != NULL);
+
+    if(!IsPortable(up) || !IsPortable(down))
+        return false;
+    switch(code)
+    {
+        case ADD:
+            *res = up + down;
+            break;
+        case SUB:
+            *res = up - down;
+            break;
+        case MUL:
+            *res = up * down;
+            break;
+        case DIV:
+            if(down == 0 || fmod(up, down) != 0)
+                return false;
+            *res = up / down;
+            break;
+        case MOD:
+            if(down == 0)
+                return false;
+            *res = (int)up % (int)down;
+            break;
+        case ABS:
+            *res = fabs(up);
+            break;
+        case SQRT:
+            if(up < 0 || sqrt(up) != floor(sqrt(up)))
+                return false;
+            *res = sqrt(up);
+            break;
+        default:
+            return false;
+    }
+    return IsPortable(*res);
+}
+
+/// Known registers are written to, what was known about the register is lost
+void Forget(RegValue* state, int reg)
+{
+    state[reg].kind = KNOWN_NOTHING;
+    for(int i = 0; i < NUMBER_OF_REGS; ++i)
+        if(state[i].kind == KNOWN_COPY && state[i].reg == reg)
+            state[i].kind = KNOWN_NOTHING;
+}
+
+///@return Value of the register: a number, other register or the register itself
+RegValue Resolve(const RegValue* state, int reg)
+{
+    if(state[reg].kind != KNOWN_NOTHING)
+        return state[reg];
+    RegValue res = {KNOWN_COPY, reg, 0};
+    return res;
+}
+
+bool SameValue(const RegValue* lhs, const RegValue* rhs)
+{
+    if(lhs->kind != rhs->kind)
+        return false;
+    if(lhs->kind == KNOWN_CONST)
+        return lhs->value == rhs->value;
+    return lhs->kind == KNOWN_NOTHING || lhs->reg == rhs->reg;
+}
+
+///@note state is changed by the command
+void Compiler::TransferRegs(size_t instr_counter, RegValue* state)
+{
+    const Instruction* cur = &syntax[instr_counter];
+    switch(cur->cmd_code)
+    {
+        case POP:
+        case TOP:
+        case INPUT:
+            Forget(state, cur->reg);
+            break;
+        case MOV:
+        {
+            RegValue value = {KNOWN_CONST, 0, cur->value};
+            if(cur->arg_flag == REG)
+                value = Resolve(state, cur->src);
+            /// The register has this value already
+            RegValue old = Resolve(state, cur->reg);
+            if(SameValue(&old, &value) || (value.kind == KNOWN_COPY && value.reg == cur->reg))
+                break;
+            Forget(state, cur->reg);
+            state[cur->reg] = value;
+            break;
+        }
+        case ADDI:
+        case SUBI:
+        case MULI:
+        {
+            RegValue value = Resolve(state, cur->src);
+            double res = 0;
+            Forget(state, cur->reg);
+            if(value.kind == KNOWN_CONST && FoldCommand(cur->cmd_code - ADDI + ADD, value.value, cur->value, &res))
+            {
+                state[cur->reg].kind = KNOWN_CONST;
+                state[cur->reg].value = res;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+//-------------------------------------------------------------------
+//! Function "RewriteRegs" replaces the registers with what is known about them
+//!
+//!@param [in] instr_counter Command to rewrite
+//!@param [in] state Registers before the command
+//!@param [in] live Flag liveness (see FlagLiveness)
+//!
+//!@param [out] removed The command is marked if it does nothing
+//!
+//!@return true, if the command is changed
+//!
+//-------------------------------------------------------------------
+bool Compiler::RewriteRegs(size_t instr_counter, const RegValue* state, const bool* live, bool* removed)
+{
+    Instruction* cur = &syntax[instr_counter];
+    Instruction old = *cur;
+    switch(cur->cmd_code)
+    {
+        case PUSH:
+        {
+            if(cur->arg_flag != REG)
+                break;
+            RegValue value = Resolve(state, cur->reg);
+            if(value.kind == KNOWN_CONST)
+            {
+                cur->arg_flag = NUM;
+                cur->value = value.value;
+            }
+            else
+                cur->reg = value.reg;
+            break;
+        }
+        case MOV:
+        {
+            RegValue value = {KNOWN_CONST, 0, cur->value};
+            if(cur->arg_flag == REG)
+                value = Resolve(state, cur->src);
+            RegValue dst = Resolve(state, cur->reg);
+            if(SameValue(&dst, &value) || (value.kind == KNOWN_COPY && value.reg == cur->reg))
+            {
+                removed[instr_counter] = true;
+                return true;
+            }
+            if(value.kind == KNOWN_CONST)
+            {
+                cur->arg_flag = NUM;
+                cur->src = 0;
+                cur->value = value.value;
+            }
+            else
+                cur->src = value.reg;
+            break;
+        }
+        case ADDI:
+        case SUBI:
+        case MULI:
+        {
+            RegValue value = Resolve(state, cur->src);
+            double res = 0;
+            if(value.kind == KNOWN_CONST && !FlagsRead(instr_counter, live)
+               && FoldCommand(cur->cmd_code - ADDI + ADD, value.value, cur->value, &res))
+            {
+                cur->cmd_code = MOV;
+                cur->arg_flag = NUM;
+                cur->src = 0;
+                cur->value = res;
+            }
+            else if(value.kind == KNOWN_COPY)
+                cur->src = value.reg;
+            break;
+        }
+        case CJE:
+        case CJNE:
+        case CJB:
+        case CJBE:
+        case CJA:
+        case CJAE:
+        {
+            RegValue up = {KNOWN_CONST, 0, cur->value};
+            RegValue down = {KNOWN_CONST, 0, cur->value};
+            if(cur->arg_flag != NUM_REG)
+                up = Resolve(state, cur->reg);
+            if(cur->arg_flag != REG_NUM)
+                down = Resolve(state, cur->src);
+
+            /// The jump is known, if nobody sees the flags
+            if(up.kind == KNOWN_CONST && down.kind == KNOWN_CONST
+               && IsPortable(up.value - down.value) && !FlagsRead(instr_counter, live))
+            {
+                int sign = Compare((int)(up.value - down.value), 0);
+                if(JumpTaken(cur->cmd_code - CJE + JE, sign))
+                {
+                    cur->cmd_code = JMP;
+                    cur->arg_flag = ADDRESS;
+                    cur->reg = 0;
+                    cur->src = 0;
+                    cur->value = 0;
+                }
+                else
+                    removed[instr_counter] = true;
+                return true;
+            }
+            if(up.kind == KNOWN_CONST && down.kind == KNOWN_CONST)
+                break;
+
+            /// At most one number
+            cur->arg_flag = (up.kind == KNOWN_CONST) ? NUM_REG : (down.kind == KNOWN_CONST) ? REG_NUM : REG_REG;
+            cur->reg = (up.kind == KNOWN_CONST) ? 0 : up.reg;
+            cur->src = (down.kind == KNOWN_CONST) ? 0 : down.reg;
+            cur->value = (up.kind == KNOWN_CONST) ? up.value : (down.kind == KNOWN_CONST) ? down.value : 0;
+            break;
+        }
+        default:
+            break;
+    }
+    return memcmp(&old, cur, sizeof(old)) != 0;
+}
+
+//-------------------------------------------------------------------
+//! Function "PropagateRegisters" puts known numbers and copies
+//! of the registers in place of their uses
+//!
+//!@return number of changed commands
+//!
+//!@note Registers are 0 at the start. States are kept only at the starts
+//!      of the blocks, the commands of a block are walked with one state.
+//!      Jumps on known numbers become JMP or vanish, MOV of the value
+//!      the register already has vanishes
+//-------------------------------------------------------------------
+size_t Compiler::PropagateRegisters()
+{
+    size_t n = number_of_instructions;
+    if(begin >= n)
+        return 0;
+
+    /// Starts of the blocks
+    bool* leader = new bool[n + 1]();
+    JumpTargets(leader);
+    leader[begin] = true;
+    for(size_t i = 0; i < n; ++i)
+        if(IsJump(syntax[i].cmd_code) || syntax[i].cmd_code == END || syntax[i].cmd_code == BEGIN)
+            leader[i + 1] = true;
+
+    size_t* slot = new size_t[n + 1];
+    size_t number_of_blocks = 0;
+    for(size_t i = 0; i < n; ++i)
+        slot[i] = leader[i] ? number_of_blocks++ : 0;
+    RegValue* in = new RegValue[number_of_blocks * NUMBER_OF_REGS]();
+    bool* visited = new bool[number_of_blocks]();
+    bool* queued = new bool[number_of_blocks]();
+    size_t* work = new size_t[number_of_blocks];
+    size_t work_size = 0;
+
+    for(int r = 0; r < NUMBER_OF_REGS; ++r)
+        in[slot[begin] * NUMBER_OF_REGS + r].kind = KNOWN_CONST;
+    visited[slot[begin]] = true;
+    queued[slot[begin]] = true;
+    work[work_size++] = begin;
+
+    RegValue state[NUMBER_OF_REGS];
+    while(work_size > 0)
+    {
+        size_t start = work[--work_size];
+        queued[slot[start]] = false;
+        memcpy(state, &in[slot[start] * NUMBER_OF_REGS], sizeof(state));
+
+        for(size_t i = start; ; ++i)
+        {
+            TransferRegs(i, state);
+            size_t next[2];
+            size_t number_of_next = Successors(i, next);
+            if(number_of_next == 1 && next[0] == i + 1 && i + 1 < n && !leader[i + 1])
+                continue;
+
+            /// End of the block
+            for(size_t j = 0; j < number_of_next; ++j)
+            {
+                if(next[j] >= n)
+                    continue;
+                RegValue* target = &in[slot[next[j]] * NUMBER_OF_REGS];
+                bool changed = !visited[slot[next[j]]];
+                if(changed)
+                    memcpy(target, state, sizeof(state));
+                else
+                    for(int r = 0; r < NUMBER_OF_REGS; ++r)
+                        if(target[r].kind != KNOWN_NOTHING && !SameValue(&target[r], &state[r]))
+                        {
+                            target[r].kind = KNOWN_NOTHING;
+                            changed = true;
+                        }
+                visited[slot[next[j]]] = true;
+                if(changed && !queued[slot[next[j]]])
+                {
+                    queued[slot[next[j]]] = true;
+                    work[work_size++] = next[j];
+                }
+            }
+            break;
+        }
+    }
+
+    /// Rewriting with the final states
+    bool* live = new bool[n + 1];
+    FlagLiveness(live);
+    bool* removed = new bool[n]();
+    size_t number_changed = 0;
+    size_t number_removed = 0;
+    for(size_t start = 0; start < n; ++start)
+    {
+        if(!leader[start] || !visited[slot[start]])
+            continue;
+        memcpy(state, &in[slot[start] * NUMBER_OF_REGS], sizeof(state));
+        for(size_t i = start; i < n && (i == start || !leader[i]); ++i)
+        {
+            if(RewriteRegs(i, state, live, removed))
+                ++number_changed;
+            if(removed[i])
+                ++number_removed;
+            else
+                TransferRegs(i, state);
+        }
+    }
+
+    if(number_removed != 0)
+        RemoveInstructions(removed);
+    delete [] removed;
+    delete [] live;
+    delete [] work;
+    delete [] queued;
+    delete [] visited;
+    delete [] in;
+    delete [] slot;
+    delete [] leader;
+    return number_changed;
+}
+
+//-------------------------------------------------------------------
+//! Function "FoldConstants" computes the commands on the pushed numbers
+//!
+//!@return number of changed commands
+//!
+//!@note push a / push b / op      ->  push (a op b)
+//!      push a / abs|sqrt         ->  push (op a)
+//!      push a / push b / cmp     ->  nothing
+//!      push a / push b / cmp / jcc :L  ->  jmp :L or nothing
+//!      Only if nobody reads the flags of the last command.
+//!      Only the first instruction of a window may be a jump target
+//-------------------------------------------------------------------
+size_t Compiler::FoldConstants()
+{
+    size_t n = number_of_instructions;
+    bool* target = new bool[n + 1];
+    JumpTargets(target);
+    bool* live = new bool[n + 1];
+    FlagLiveness(live);
+    bool* removed = new bool[n]();
+    size_t number_changed = 0;
+
+    for(size_t i = 0; i + 1 < n; ++i)
+    {
+        Instruction* cur = &syntax[i];
+        if(!IsCommand(i, PUSH) || cur->arg_flag != NUM || target[i + 1])
+            continue;
+
+        int code = syntax[i + 1].cmd_code;
+        double res = 0;
+        if((code == ABS || code == SQRT) && !FlagsRead(i + 1, live)
+           && FoldCommand(code, cur->value, 0, &res))
+        {
+            cur->value = res;
+            removed[i + 1] = true;
+            ++number_changed;
+            ++i;
+            continue;
+        }
+
+        if(!IsCommand(i + 1, PUSH) || syntax[i + 1].arg_flag != NUM || i + 2 >= n || target[i + 2])
+            continue;
+        double down = syntax[i + 1].value;
+        code = syntax[i + 2].cmd_code;
+        if(code >= ADD && code <= MOD && !FlagsRead(i + 2, live)
+           && FoldCommand(code, cur->value, down, &res))
+        {
+            cur->value = res;
+            removed[i + 1] = removed[i + 2] = true;
+            ++number_changed;
+            i += 2;
+            continue;
+        }
+        if(code != CMP || !IsPortable(cur->value) || !IsPortable(down) || !IsPortable(cur->value - down))
+            continue;
+
+        if(!FlagsRead(i + 2, live))
+        {
+            removed[i] = removed[i + 1] = removed[i + 2] = true;
+            ++number_changed;
+            i += 2;
+        }
+        else if(i + 3 < n && !target[i + 3] && syntax[i + 3].cmd_code >= JE
+                && syntax[i + 3].cmd_code <= JAE && !FlagsRead(i + 3, live))
+        {
+            int sign = Compare((int)(cur->value - down), 0);
+            if(JumpTaken(syntax[i + 3].cmd_code, sign))
+            {
+                *cur = syntax[i + 3];
+                removed[i + 1] = removed[i + 2] = removed[i + 3] = true;
+                cur->cmd_code = JMP;
+            }
+            else
+                removed[i] = removed[i + 1] = removed[i + 2] = removed[i + 3] = true;
+            ++number_changed;
+            i += 3;
+        }
+    }
+
+    if(number_changed != 0)
+        RemoveInstructions(removed);
+    delete [] removed;
+    delete [] live;
+    delete [] target;
+    return number_changed;
+}
+
+///@return number of removed commands
+///
+///@note Removes the commands that can't be reached from "begin"
+///      and the jumps to the next command. The first "BEGIN" is kept for FindBegin
+size_t Compiler::RemoveUnreachable()
+{
+    size_t n = number_of_instructions;
+    bool* reached = new bool[n + 1]();
+    size_t* work = new size_t[n + 1];
+    size_t work_size = 0;
+    if(begin < n)
+    {
+        reached[begin] = true;
+        work[work_size++] = begin;
+    }
+    while(work_size > 0)
+    {
+        size_t next[2];
+        size_t number_of_next = Successors(work[--work_size], next);
+        for(size_t j = 0; j < number_of_next; ++j)
+            if(!reached[next[j]])
+            {
+                reached[next[j]] = true;
+                work[work_size++] = next[j];
+            }
+    }
+
+    bool* removed = new bool[n]();
+    size_t number_removed = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        int code = syntax[i].cmd_code;
+        bool jump_next = (code == JMP || (code >= JE && code <= JAE)) && (size_t)syntax[i].address == i + 1;
+        if((!reached[i] && i + 1 != begin) || jump_next)
+        {
+            removed[i] = true;
+            ++number_removed;
+        }
+    }
+
+    if(number_removed != 0)
+        RemoveInstructions(removed);
+    delete [] removed;
+    delete [] work;
+    delete [] reached;
+    return number_removed;
+}
+
+///@return bits of the registers read by the command
+unsigned RegsUsed(const Instruction* cur)
+{
+    switch(cur->cmd_code)
+    {
+        case PUSH:
+            return (cur->arg_flag == REG) ? 1u << cur->reg : 0;
+        case OUTPUT:
+            return 1u << cur->reg;
+        case DUMP:
+            return (1u << NUMBER_OF_REGS) - 1;
+        case MOV:
+            return (cur->arg_flag == REG) ? 1u << cur->src : 0;
+        case ADDI:
+        case SUBI:
+        case MULI:
+            return 1u << cur->src;
+        case CJE:
+        case CJNE:
+        case CJB:
+        case CJBE:
+        case CJA:
+        case CJAE:
+            return ((cur->arg_flag != NUM_REG) ? 1u << cur->reg : 0)
+                   | ((cur->arg_flag != REG_NUM) ? 1u << cur->src : 0);
+        default:
+            return 0;
+    }
+}
+
+///@return bits of the registers written by the command
+unsigned RegsSet(const Instruction* cur)
+{
+    switch(cur->cmd_code)
+    {
+        case POP:
+        case TOP:
+        case INPUT:
+        case MOV:
+        case ADDI:
+        case SUBI:
+        case MULI:
+            return 1u << cur->reg;
+        default:
+            return 0;
+    }
+}
+
+///@return number of removed commands
+///
+///@note MOV, ADDI, SUBI and MULI are removed if nothing reads their register
+///      (and their flags) before it is written again or the program stops
+size_t Compiler::RemoveDeadStores()
+{
+    size_t n = number_of_instructions;
+    unsigned* live = new unsigned[n + 1]();
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(size_t i = n; i-- > 0; )
+        {
+            size_t next[2];
+            size_t number_of_next = Successors(i, next);
+            unsigned out = 0;
+            for(size_t j = 0; j < number_of_next; ++j)
+                out |= live[next[j]];
+            unsigned res = RegsUsed(&syntax[i]) | (out & ~RegsSet(&syntax[i]));
+            if(res != live[i])
+            {
+                live[i] = res;
+                changed = true;
+            }
+        }
+    }
+
+    bool* flags_live = new bool[n + 1];
+    FlagLiveness(flags_live);
+    bool* removed = new bool[n]();
+    size_t number_removed = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        int code = syntax[i].cmd_code;
+        if(code != MOV && code != ADDI && code != SUBI && code != MULI)
+            continue;
+        /// These commands always go to the next one
+        if((live[i + 1] & (1u << syntax[i].reg)) != 0 || (code != MOV && FlagsRead(i, flags_live)))
+            continue;
+        removed[i] = true;
+        ++number_removed;
+    }
+
+    if(number_removed != 0)
+        RemoveInstructions(removed);
+    delete [] removed;
+    delete [] flags_live;
+    delete [] live;
+    return number_removed;
+}
+
+//-------------------------------------------------------------------
+//! Function "Optimize" runs the dataflow passes until nothing changes
+//!
+//!@return number of commands removed by the dataflow passes
+//!
+//!@note Numbers are folded only if the result is exact for every
+//!      type of the processor (integers of int range).
+//!      Peephole runs in every round if it is enabled, its commands are added to PeepholeRemoved
+//-------------------------------------------------------------------
+size_t Compiler::Optimize()
+{
+    size_t before = number_of_instructions;
+    size_t by_peephole = 0;
+    for(int round = 0; round < OPTIMIZER_ROUNDS; ++round)
+    {
+        size_t number_changed = 0;
+        FindBegin();
+        number_changed += PropagateRegisters();
+        number_changed += FoldConstants();
+        FindBegin();
+        number_changed += RemoveUnreachable();
+        number_changed += RemoveDeadStores();
+        if(PassEnabled(PASS_PEEPHOLE))
+        {
+            size_t removed = Peephole();
+            by_peephole += removed;
+            number_changed += removed;
+        }
+        if(number_changed == 0)
+            break;
+    }
+    peephole_removed += by_peephole;
+    return before - number_of_instructions - by_peephole;
+}
+
+//-------------------------------------------------------------------
+//! Function "Layout" puts the basic blocks in the order of the hot ways (see FlowGraph)
+//!
+//!@return number of removed JMP commands, 0 if there are more of them
+//!
+//!@note Jumps to jumps are threaded, a condition over a jump is inverted,
+//!      loops get their test at the bottom. Lines and labels move with the commands
+//-------------------------------------------------------------------
+size_t Compiler::Layout()
+{
+    FindBegin();
+    FlowGraph graph;
+    if(!graph.Build(syntax, number_of_instructions, begin))
+        return 0;
+    graph.Thread();
+    graph.Place();
+
+    Instruction* code = NULL;
+    size_t* code_lines = NULL;
+    size_t* new_index = new size_t[number_of_instructions + 1];
+    size_t size = graph.Emit(lines, &code, &code_lines, new_index);
+    for(size_t i = 0; i < number_of_labels; ++i)
+        addresses[i] = new_index[addresses[i]];
+
+    size_t jumps_before = 0;
+    size_t jumps_after = 0;
+    for(size_t i = 0; i < number_of_instructions; ++i)
+        jumps_before += (syntax[i].cmd_code == JMP);
+    for(size_t i = 0; i < size; ++i)
+        jumps_after += (code[i].cmd_code == JMP);
+
+    delete [] new_index;
+    delete [] syntax;
+    delete [] lines;
+    syntax = code;
+    lines = code_lines;
+    number_of_instructions = size;
+    return (jumps_before > jumps_after) ? jumps_before - jumps_after : 0;
+}
 
-    /// Splitting by the words
-    char** pointers = MyStrtok(buffer, " \n\t", &number_of_lexems);
-    if(pointers == NULL)
+//-------------------------------------------------------------------
+//! Function "MarkDeadFlags" finds the commands whose flags are never read
+//!
+//!@return number of marked commands
+//!
+//!@note Marks are written to the address of the commands that aren't jumps (see FLAGS_UNUSED)
+//-------------------------------------------------------------------
+size_t Compiler::MarkDeadFlags()
+{
+    bool* live = new bool[number_of_instructions + 1];
+    FlagLiveness(live);
+    size_t number_marked = 0;
+    for(size_t i = 0; i < number_of_instructions; ++i)
+    {
+        int code = syntax[i].cmd_code;
+        if(SetsFlags(code) && !IsJump(code) && !FlagsRead(i, live))
+        {
+            syntax[i].address = FLAGS_UNUSED;
+            ++number_marked;
+        }
+    }
+    delete [] live;
+    return number_marked;
+}
+
+void Compiler::FindBegin()
+{
+    for(begin = 0; begin < number_of_instructions; ++begin)
+        if(syntax[begin].cmd_flag == CMD && syntax[begin].cmd_code == BEGIN)
+            break;
+    if(begin == number_of_instructions)
+        CompError(NO_BEGIN, 0);
+
+    ++begin; // next command after "BEGIN"
+}
+
+///@note Compiler may be used for many programs
+void Compiler::Clear()
+{
+    labels.Clear();
+    number_of_labels = 0;
+    delete [] addresses;
+    addresses = NULL;
+
+    number_of_lexems = 0;
+    delete [] lexic;
+    lexic = NULL;
+
+    number_of_instructions = 0;
+    delete [] syntax;
+    syntax = NULL;
+    delete [] lines;
+    lines = NULL;
+    begin = 0;
+    peephole_removed = 0;
+    optimizer_removed = 0;
+    dead_flags = 0;
+    jumps_removed = 0;
+}
+
+//-------------------------------------------------------------------
+//! Function "CompileSource" compiles the text in memory
+//!
+//!@param [in] source Text of the program, not NUL-terminated
+//!@param [in] size Number of bytes in the text
+//!
+//!@param [out] program Compiled program
+//!
+//!@return Number of commands
+//!
+//-------------------------------------------------------------------
+size_t Compiler::CompileSource(const char* source, size_t size, Program* program)
+{
+    assert(source != NULL || size == 0);
+    assert(program != NULL);
+
+    Clear();
+    Lexer lexer(source, size);
+
+    /// Registration of labels, counting words
+    LabelRegistrator(&lexer);
+    if(number_of_lexems == 0)
     {
         printf("Error: empty array\n");
         exit(1);
     }
-  
-    /// Registration of labels and functions
-    LabelRegistrator(pointers);
 
     /// Lexic analysis
-    LexicAnalysis(pointers);
-    delete [] pointers;
-    delete [] buffer;
+    lexer.Rewind();
+    LexicAnalysis(&lexer);
 
     /// Syntax analysis
     SyntaxAnalysis();
 
-    /// Printing in the .o file
-    SyntaxToFile(out_file);
+    /// Optimizations
+    if(PassEnabled(PASS_PEEPHOLE))
+        peephole_removed = Peephole();
+    if(PassEnabled(PASS_DATAFLOW))
+        optimizer_removed = Optimize();
+    if(PassEnabled(PASS_LAYOUT))
+        jumps_removed = Layout();
+    if(PassEnabled(PASS_DEAD_FLAGS))
+        dead_flags = MarkDeadFlags();
 
+    /// Resolving the entry point
+    FindBegin();
+
+    program->Assign(syntax, number_of_instructions, begin);
+    const char** names = new const char*[number_of_labels];
+    for(size_t i = 0; i < number_of_labels; ++i)
+        names[i] = labels.Name(i);
+    program->SetDebugInfo(lines, number_of_labels, names, addresses);
+    delete [] names;
     return number_of_instructions;
 }
+
+size_t Compiler::CompileFile(const char* in_file, Program* program)
+{
+    /// Enter data from the file
+    size_t size = 0;
+    const char* text = MapFile(in_file, &size);
+    size_t res = CompileSource(text, size, program);
+    munmap((void*)text, size);
+    return res;
+}
+
+///@note Writes the object file for Processor::Run
+size_t Compiler::Compile(const char* in_file, const char* out_file)
+{
+    Program program;
+    size_t res = CompileFile(in_file, &program);
+    program.Save(out_file);
+    return res;
+}
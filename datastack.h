@@ -0,0 +1,213 @@
+#pragma once
+
+#include<csignal>
+#include<csetjmp>
+#include<pthread.h>
+#include<sys/mman.h>
+#include"functions.h"
+
+/// Pages of a stack between two pages without access.
+/// Push and pop don't check the depth: going past either end
+/// touches a guard page, the fault is caught and reported as a VM error
+class StackRegion
+{
+    protected:
+        char* region;        /// Guard page, data pages, guard page
+        size_t region_size;
+        size_t page_size;
+        char* data;          /// First data byte
+        char* data_end;      /// Past the last data byte
+
+        void Map(size_t bytes);
+        void Unmap();
+
+    public:
+        StackRegion()
+        {
+            region = NULL;
+            region_size = 0;
+            page_size = 0;
+            data = NULL;
+            data_end = NULL;
+        }
+        int Guard(const void* address);
+        ~StackRegion()
+        {
+            Unmap();
+        }
+};
+
+///@note Size is rounded up to the whole pages
+void StackRegion::Map(size_t bytes)
+{
+    Unmap();
+    page_size = sysconf(_SC_PAGESIZE);
+    size_t data_size = (bytes + page_size - 1) / page_size * page_size;
+    if(data_size == 0)
+        data_size = page_size;
+    region_size = data_size + 2 * page_size;
+
+    void* memory = mmap(NULL, region_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED)
+    {
+        printf("Memory error\n");
+        exit(1);
+    }
+    region = (char*)memory;
+    if(mprotect(region + page_size, data_size, PROT_READ | PROT_WRITE) != 0)
+    {
+        printf("Memory error\n");
+        exit(1);
+    }
+    data = region + page_size;
+    data_end = data + data_size;
+}
+
+void StackRegion::Unmap()
+{
+    if(region != NULL)
+        munmap(region, region_size);
+    region = NULL;
+    data = data_end = NULL;
+}
+
+///@return -1, if address is in the lower guard page (underflow)
+///         1, if address is in the upper guard page (overflow)
+///         0, if not
+int StackRegion::Guard(const void* address)
+{
+    const char* place = (const char*)address;
+    if(region == NULL || place < region || place >= region + region_size)
+        return 0;
+    if(place < data)
+        return -1;
+    if(place >= data_end)
+        return 1;
+    return 0;
+}
+
+/// Stack of numbers of type T in the guarded region.
+/// Capacity is the depth asked for: the load checks and the register form keep to it,
+/// the guard page past the rounded pages only catches the programs whose depth isn't static
+template<class T>
+class BasicDataStack : public StackRegion
+{
+    private:
+        T* base;             /// First element
+        T* limit;            /// Past the last element asked for
+        T* top;              /// Next free element
+
+    public:
+        BasicDataStack()
+        {
+            base = NULL;
+            limit = NULL;
+            top = NULL;
+        }
+        void Create(size_t elems)
+        {
+            Map(elems * sizeof(T));
+            base = top = (T*)data;
+            limit = base + elems;
+        }
+        void Push(T value) { *top++ = value; }
+        T Pop() { return *--top; }
+        T Top() { return top[-1]; }
+        void Clear() { top = base; }
+        size_t Size() { return top - base; }
+        size_t Capacity() { return limit - base; }
+        const T* Base() { return base; }
+        void Restore(const void* elems, size_t number);
+        void Dump();
+};
+
+typedef BasicDataStack<double> DataStack;
+
+///@note Replaces the contents with the bytes of number elements,
+///      number must not exceed Capacity()
+template<class T>
+void BasicDataStack<T>::Restore(const void* elems, size_t number)
+{
+    assert(elems != NULL || number == 0);
+    assert(number <= Capacity());
+
+    memcpy(base, elems, number * sizeof(T));
+    top = base + number;
+}
+
+template<class T>
+void BasicDataStack<T>::Dump()
+{
+    std::cout << "Stack contains " << Size() << " elements" << std::endl;
+    for(T* elem = base; elem < top; ++elem)
+        std::cout << "    " << *elem << std::endl;
+}
+
+/// Stack watched by the fault handler and the place to report the fault,
+/// every thread runs its own processor
+thread_local StackRegion* guarded_stack = NULL;
+thread_local sigjmp_buf guarded_return;
+
+/// Actions of the process from before the first watched stack,
+/// they are back when no thread watches a stack
+pthread_mutex_t guard_lock = PTHREAD_MUTEX_INITIALIZER;
+size_t guarding_threads = 0;
+struct sigaction saved_segv_action;
+struct sigaction saved_bus_action;
+
+void StackFaultHandler(int sig, siginfo_t* info, void* context)
+{
+    int side = (guarded_stack != NULL) ? guarded_stack->Guard(info->si_addr) : 0;
+    if(side != 0)
+        siglongjmp(guarded_return, side);
+
+    /// Not a stack fault: it goes to the action of the process
+    const struct sigaction* saved = (sig == SIGBUS) ? &saved_bus_action : &saved_segv_action;
+    if(saved->sa_flags & SA_SIGINFO)
+        saved->sa_sigaction(sig, info, context);
+    else if(saved->sa_handler != SIG_DFL && saved->sa_handler != SIG_IGN)
+        saved->sa_handler(sig);
+    else
+    {
+        /// The fault comes again on return and takes the default action,
+        /// it can't be ignored
+        signal(sig, SIG_DFL);
+    }
+}
+
+//-------------------------------------------------------------------
+//! Function "GuardStack" starts catching faults in the guard pages
+//!
+//!@param [in] stack Stack to watch, NULL stops watching
+//!
+//!@note Call sigsetjmp(guarded_return, 1) before running the program:
+//!      it returns -1 after underflow and 1 after overflow.
+//!      The handler is set by the first watching thread
+//!      and the old one is restored by the last
+//!
+//-------------------------------------------------------------------
+void GuardStack(StackRegion* stack)
+{
+    bool was_watching = (guarded_stack != NULL);
+    guarded_stack = stack;
+    if(was_watching == (stack != NULL))
+        return;
+
+    pthread_mutex_lock(&guard_lock);
+    if(stack != NULL && guarding_threads++ == 0)
+    {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = StackFaultHandler;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &saved_segv_action);
+        sigaction(SIGBUS, &action, &saved_bus_action);
+    }
+    else if(stack == NULL && --guarding_threads == 0)
+    {
+        sigaction(SIGSEGV, &saved_segv_action, NULL);
+        sigaction(SIGBUS, &saved_bus_action, NULL);
+    }
+    pthread_mutex_unlock(&guard_lock);
+}
@@ -1,3 +1,5 @@
+#include <cstdint>
+
 enum Flag
 {
     ERR_FLAG = 0,
@@ -8,6 +10,11 @@ enum Flag
     LABEL = 5,
     LABEL_ARG = 6,
     ADDRESS = 7,
+
+    /// Operands of the fused compare-and-jump commands
+    REG_REG = 8,   /// reg and src registers
+    REG_NUM = 9,   /// reg register and value
+    NUM_REG = 10,  /// value and src register
 };
 
 enum Command
@@ -35,7 +42,22 @@ enum Command
     JB = 120,
     JBE = 121,
     JA = 122,
-    JAE = 123
+    JAE = 123,
+
+    /// Produced by the optimizer only, there are no mnemonics for them
+    MOV = 124,  /// reg = value (NUM) or reg = src register (REG)
+    ADDI = 125, /// reg = src + value
+    SUBI = 126, /// reg = src - value
+    MULI = 127, /// reg = src * value
+
+    /// cmp of two operands (see REG_REG, REG_NUM, NUM_REG)
+    /// followed by the jump to address
+    CJE = 128,
+    CJNE = 129,
+    CJB = 130,
+    CJBE = 131,
+    CJA = 132,
+    CJAE = 133
 };
 
 enum Register
@@ -50,6 +72,10 @@ enum Register
     BP = 207
 };
 
+/// Registers are stored in instructions as dense indices
+const int NUMBER_OF_REGS = BP - AX + 1;
+const char* const REG_NAMES[NUMBER_OF_REGS] = {"AX", "BX", "CX", "DX", "SI", "DI", "BP"};
+
 enum Error
 {
     UNKNOWN = 300,      /// if label is wrong
@@ -69,15 +95,56 @@ struct Lexem
 {
     Flag flag; //Flag
     double obj; //object_t
+    size_t line;   //position in the source
+    size_t column;
 };
 
 /// Structure using in semantic analysis
 /// contain command (with flag and code)
 /// and argument (with type and value)
-struct Instruction
+template<class T>
+struct BasicInstruction
 {
     int cmd_flag; //Flag
     int cmd_code; //Command
     int arg_flag; //Flag
-    double value; //argument_t
+    int reg;      //register index 0..6 if arg_flag is REG
+    T value;      //argument_t
+    int src;      //source register index of MOV/ADDI/SUBI/MULI/CJxx
+    int address;  //jump target, FLAGS_UNUSED for the other commands if their flags are never read
+};
+
+/// Mark of the compiler: no jump or DUMP can see the flags of this command
+const int FLAGS_UNUSED = -1;
+
+/// Compiler and object files always use double operands,
+/// processors of other types convert them when the program is loaded
+typedef BasicInstruction<double> Instruction;
+
+/// Binary object file: ObjectHeader followed by
+/// number_of_instructions Instruction records
+const uint32_t OBJECT_MAGIC = 0x4F4D5650; /// "PVMO"
+const uint32_t OBJECT_VERSION = 5;
+
+struct ObjectHeader
+{
+    uint32_t magic;                   /// OBJECT_MAGIC
+    uint32_t version;                 /// OBJECT_VERSION
+    uint64_t number_of_instructions;
+    uint64_t begin;                   /// first command after BEGIN
+    uint64_t checksum;                /// Checksum() of the instructions
+};
+
+/// Debug file of an object file: DebugHeader, the line of every command (uint64_t),
+/// then the address (uint64_t), the length of the name (uint64_t) and the name of every label
+const uint32_t DEBUG_MAGIC = 0x47445650; /// "PVDG"
+const uint32_t DEBUG_VERSION = 1;
+
+struct DebugHeader
+{
+    uint32_t magic;                   /// DEBUG_MAGIC
+    uint32_t version;                 /// DEBUG_VERSION
+    uint64_t number_of_instructions;  /// the same as in the object file
+    uint64_t number_of_labels;
+    uint64_t checksum;                /// Checksum() of everything after the header
 };
@@ -7,142 +7,159 @@
 #include<cassert>
 #include<iostream>
 #include<cmath>
+#include<climits>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
 #include "enums.h"
 
-#define MAXNUM 500
 #define eps 1e-10
+#define NOT_FOUND -1
 //-------------------------------------------------------------------
-//! Function "MyStrtok" breaks line to tokens
+//! Function "MapFile" maps the whole file to memory for reading
 //!
-//!@param [in] string Line we are working with
-//!@param [in] delim Array, contains separators
+//!@param [in] in_file Name of the file
 //!
-//!@param [out] num Number of tokens in line
+//!@param [out] size Number of bytes in the file
 //!
-//!@return Array with pointers to start of tokens
+//!@return Pointer to the start of the mapped file,
+//!        it must be released with munmap(pointer, size)
 //!
-//!@note If there is more tokens that defined,
-//!      or there isn't any tokens,
-//!      function returned NULL
+//!@note The text is not NUL-terminated
 //!
 //-------------------------------------------------------------------
-char** MyStrtok(char string[], const char* delim, size_t* num)
+const char* MapFile(const char* in_file, size_t* size)
 {
-    assert(string != NULL);
-    assert(delim != NULL);
-
-    char** array = new char*[MAXNUM];
-    size_t string_counter = 0; /// counter in "string"
-    size_t array_counter = 0; /// counter in "array"
-    size_t len = strlen(string);
-
-    /// Ignoring separators in the beginning
-    while(IsSymbol(string[string_counter], delim) && string[string_counter] != '\0')
-        ++string_counter;
+    /// Checking correctness of entry
+    assert(in_file != NULL);
+    assert(size != NULL);
 
-    /// If there are only separators in line
-    if(string_counter == len)
-        return NULL;
+    int fd = open(in_file, O_RDONLY);
+    if(fd < 0)
+    {
+        printf("Can't open %s\n", in_file);
+        exit(1);
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0)
+    {
+        printf("Can't read %s\n", in_file);
+        exit(1);
+    }
 
-    /// The first token
-    array[0] = &string[string_counter];
-    ++string_counter;
-    ++array_counter;
+    /// Checking emptiness
+    *size = info.st_size;
+    if(*size == 0)
+    {
+        printf("File is empty");
+        exit(1);
+    }
 
-    while(string[string_counter] != '\0')
+    void* text = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(text == MAP_FAILED)
     {
-        if(array_counter > MAXNUM)
-            return NULL;
-        if(IsSymbol(string[string_counter], delim) && string_counter + 1 <= len)
-            string[string_counter] = '\0';
-        else if(string[string_counter - 1] == '\0')
-        {
-            array[array_counter++] = &string[string_counter];
-        }
-        ++string_counter;
+        printf("Memory error\n");
+        exit(1);
     }
-    *num = array_counter;
-    delete [] &array[array_counter];
-    return array;
+    return (const char*)text;
 }
 
 //------------------------------------------------------
-//! Function "IsSymbol" checks existing symbol in line
+//! Function "Checksum" counts FNV-1a hash of the bytes
 //!
-//!@param [in] symb Symbol to check
-//!@param [in] delim Line to check
+//!@param [in] data Pointer to the start of the bytes
+//!@param [in] size Number of bytes
+//!@param [in] hash Hash of the previous bytes to continue
 //!
-//!@return true, if symbol exist in line
-//!        false, if not
+//!@return 64-bit hash
 //!
 //------------------------------------------------------
-bool IsSymbol(char symb, const char* delim)
+uint64_t Checksum(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
 {
-    assert(delim != NULL);
+    assert(data != NULL || size == 0);
 
-    size_t len = strlen(delim);
-    for(size_t i = 0; i < len; ++i)
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(size_t i = 0; i < size; ++i)
     {
-        if(symb != delim[i])
-            continue;
-        else return true;
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
     }
-    return false;
+    return hash;
 }
 
-//-----------------------------------------------
-//! Function "CountSymbols" count symbols in file
+//------------------------------------------------------
+//! Function "IsJump" checks if the command uses address
 //!
-//!@param [in] file File we are working with
+//!@param [in] code Command code
 //!
-//!@return Number of symbols
+//!@return true, if command is a jump
+//!        false, if not
 //!
-//-----------------------------------------------
-size_t CountSymbols(FILE* in)
+//------------------------------------------------------
+bool IsJump(int code)
 {
-    /// Checking correctness of entry
-    assert(in != NULL);
-
-    /// Counting symbols
-    fseek(in, 0, SEEK_END);
-    size_t count = ftell(in);
-    fseek(in, 0, SEEK_SET);
-    //rewind(in);
-
-    /// Checking emptiness
-    if(count == 0)
+    switch(code)
     {
-        printf("File is empty");
-        exit(1);
+        case JMP:
+        case JE:
+        case JNE:
+        case JB:
+        case JBE:
+        case JA:
+        case JAE:
+        case CJE:
+        case CJNE:
+        case CJB:
+        case CJBE:
+        case CJA:
+        case CJAE:
+            return true;
+        default:
+            return false;
     }
-    return count;
 }
 
-//----------------------------------------------
-//! Function "FileToArray" write file to array
+///@return true for the commands that set the flags (the fused jumps too)
+bool SetsFlags(int code)
+{
+    return (code >= ADD && code <= MOD) || code == SQRT || code == ABS || code == CMP
+           || (code >= ADDI && code <= MULI) || (code >= CJE && code <= CJAE);
+}
+
+///@return true for the commands that read the flags set before them
+bool ReadsFlags(int code)
+{
+    return (code >= JE && code <= JAE) || code == DUMP;
+}
+
+//------------------------------------------------------
+//! Function "JumpTaken" checks the condition of the jump
 //!
-//!@param [in] file File we are working with
+//!@param [in] jump One of JE..JAE
+//!@param [in] sign Sign of the last result that set the flags
 //!
-//!@return Pointer to the start of the array
+//!@return true, if the jump is taken
 //!
-//----------------------------------------------
-char* FileToArray(const char* in_file)
+//!@note JB is taken on equal numbers too, as it always was
+//------------------------------------------------------
+inline bool JumpTaken(int jump, int sign)
 {
-    /// Checking correctness of entry
-    FILE* in = fopen(in_file, "r");
-    assert(in != NULL);
-    size_t numsymb = CountSymbols(in);
-
-    /// Creating array of symbols
-    char* text = new char[numsymb];
-    if(text == NULL)
+    switch(jump)
     {
-        printf("Memory error\n");
-        exit(1);
+        case JE:
+            return sign == 0;
+        case JNE:
+            return sign != 0;
+        case JB:
+        case JBE:
+            return sign <= 0;
+        case JA:
+            return sign > 0;
+        default:
+            return sign >= 0;
     }
-    fread(text, sizeof(char), numsymb, in);
-    fclose(in);
-    return text;
 }
 
 int Compare(double param, double num)
@@ -159,19 +176,19 @@ int Compare(double param, double num)
 //! Function "IsNumeral" checks if the word is a numeral
 //!
 //!@param [in] data Word to check
+//!@param [in] len Length of the word
 //!
 //!@return true, if word is a numeral
 //!        false, if not
 //!
 //------------------------------------------------------
-bool IsNumeral(char* data)
+bool IsNumeral(const char* data, size_t len)
 {
     assert(data != NULL);
     bool first_dot = false;
 
-    size_t len = strlen(data);
     for(size_t i = 0; i < len; ++i)
-        if(!isdigit(data[i]))
+        if(!isdigit((unsigned char)data[i]))
         {
             /// Maybe it is a floating type numeral
             if(first_dot == false && i != len - 1 && data[i] == '.')
@@ -182,10 +199,35 @@ bool IsNumeral(char* data)
     return true;
 }
 
+//------------------------------------------------------
+//! Function "ParseNumeral" counts value of the numeral
+//!
+//!@param [in] data Numeral, checked by IsNumeral
+//!@param [in] len Length of the numeral
+//!
+//!@return Value of the numeral
+//!
+//------------------------------------------------------
+double ParseNumeral(const char* data, size_t len)
+{
+    assert(data != NULL);
+
+    /// atof needs NUL-terminated line
+    char buffer[64];
+    char* line = (len < sizeof(buffer)) ? buffer : new char[len + 1];
+    memcpy(line, data, len);
+    line[len] = '\0';
+    double res = atof(line);
+    if(line != buffer)
+        delete [] line;
+    return res;
+}
+
 //------------------------------------------------------------
 //! Function "IsLabel" checks if the word is a label
 //!
 //!@param [in] data Word to check
+//!@param [in] len Length of the word
 //!
 //!@return true, if word is a label
 //!        false, if not
@@ -193,16 +235,15 @@ bool IsNumeral(char* data)
 //!@note Allowed only letters, numbers and underscore(_) symbol
 //!      and label must END with a column(:)
 //------------------------------------------------------------
-bool IsLabel(char* data)
+bool IsLabel(const char* data, size_t len)
 {
     assert(data != NULL);
 
-    size_t len = strlen(data);
-    if(data[len-1] != ':')
+    if(len < 2 || data[len-1] != ':')
         return false;
 
     for(size_t i = 0; i < len - 1; ++i)
-        if(!isalnum(data[i]) && data[i] != '_')
+        if(!isalnum((unsigned char)data[i]) && data[i] != '_')
             return false;
     return true;
 }
@@ -211,6 +252,7 @@ bool IsLabel(char* data)
 //! Function "IsLabelArg" checks if the word is an argument to function "JMP"
 //!
 //!@param [in] data Word to check
+//!@param [in] len Length of the word
 //!
 //!@return true, if word is a label-argument
 //!        false, if not
@@ -218,58 +260,55 @@ bool IsLabel(char* data)
 //!@note Allowed only letters, numbers and underscore symbol
 //!      and label must BEGIN with a column
 //--------------------------------------------------------------------------
-bool IsLabelArg(char* data)
+bool IsLabelArg(const char* data, size_t len)
 {
     assert(data != NULL);
 
-    size_t len = strlen(data);
-    if(data[0] != ':')
+    if(len < 2 || data[0] != ':')
         return false;
 
     for(size_t i = 1; i < len; ++i)
-        if(!isalnum(data[i]) && data[i] != '_')
+        if(!isalnum((unsigned char)data[i]) && data[i] != '_')
             return false;
     return true;
 }
 
-char* DeleteColumn(char* data)
-{
-    assert(data != NULL);
-    if(data[0] == ':')
-        return (data + 1);
-
-    size_t len = strlen(data);
-    char* res = new char[len];
-    for(size_t i = 0; i < len-1; ++i)
-        res[i] = data[i];
-    res[len-1] = '\0';
-    return res;
-}
-
-void CompError(Error err, int num)
+const char* ErrorText(Error err)
 {
     switch(err)
     {
         case UNKNOWN:
-            printf("Compilation error: word %d: unknown statement\n", num);
-            exit(1);
+            return "unknown statement";
         case WRONG_TOKEN:
-            printf("Compilation error: line %d: wrong statement\n", num);
-            exit(1);
+            return "wrong statement";
         case NEED_ARG:
-            printf("Compilation error: line %d: need argument after this command\n", num);
-            exit(1);
+            return "need argument after this command";
         case NO_ARG:
-            printf("Compilation error: line %d: can't be any arguments after this command\n", num);
-            exit(1);
+            return "can't be any arguments after this command";
         case WRONG_END:
-            printf("Compilation error: line %d: list can't end with this command\n", num);
-            exit(1);
+            return "list can't end with this command";
         case NO_BEGIN:
-            printf("Compilation error: couldn't find BEGIN\n");
-            exit(1);
+            return "couldn't find BEGIN";
         case MANY_BEGIN:
-            printf("Compilation error: line %d: second BEGIN\n", num);
-            exit(1);
+            return "second BEGIN";
+        default:
+            return "unknown error";
     }
 }
+
+///@note Used for errors in the source: position of the word
+[[noreturn]] void CompError(Error err, size_t line, size_t column)
+{
+    printf("Compilation error: line %zu, column %zu: %s\n", line, column, ErrorText(err));
+    exit(1);
+}
+
+///@note Used for errors in the object file: number of the command
+[[noreturn]] void CompError(Error err, int num)
+{
+    if(err == NO_BEGIN)
+        printf("Compilation error: %s\n", ErrorText(err));
+    else
+        printf("Compilation error: command %d: %s\n", num, ErrorText(err));
+    exit(1);
+}
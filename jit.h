@@ -0,0 +1,500 @@
+#pragma once
+
+#include<sys/mman.h>
+#include"translator.h"
+
+/// INPUT and OUTPUT of the native code are done by the owner of the program
+typedef void (*JitNumberHook)(void* owner, double* frame, int reg);
+typedef void (*JitEndHook)(void* owner);
+
+struct JitHooks
+{
+    void* owner;
+    JitNumberHook input;
+    JitNumberHook output;
+    JitEndHook end;
+};
+
+/// Data of the running native code, its address is kept in rbp
+struct JitContext
+{
+    unsigned char ZF;      /// offset 0
+    unsigned char above;   /// offset 1
+    double epsilon;        /// offset 8
+    double neg_epsilon;    /// offset 16
+    JitHooks hooks;        /// offset 24
+};
+
+const int JIT_ZF = 0;
+const int JIT_ABOVE = 1;
+const int JIT_EPS = 8;
+const int JIT_NEG_EPS = 16;
+const int JIT_OWNER = 24;
+const int JIT_INPUT = 32;
+const int JIT_OUTPUT = 40;
+const int JIT_END = 48;
+
+/// Errors reported from the native code
+enum JitError
+{
+    JIT_DIV_ZERO = 0,
+    JIT_NEG_SQRT = 1,
+    JIT_MANY_BEGIN = 2,
+    JIT_WRONG_COMMAND = 3
+};
+
+//-------------------------------------------------------------------
+// Helpers called from the native code.
+// User registers are saved to the frame before every call.
+//-------------------------------------------------------------------
+double JitMod(double up_arg, double down_arg)
+{
+    if(Compare(down_arg, 0) == 0)
+    {
+        printf("Can't divide by 0");
+        exit(1);
+    }
+    return (int)up_arg % (int)down_arg;
+}
+
+///@note The same expression as in Processor::CommandAbs
+double JitAbs(double num)
+{
+    return fabs(num);
+}
+
+void JitFail(int err, int origin)
+{
+    switch(err)
+    {
+        case JIT_DIV_ZERO:
+            printf("Can't divide by 0");
+            exit(1);
+        case JIT_NEG_SQRT:
+            printf("Can't extract square root from negative number\n");
+            exit(1);
+        case JIT_MANY_BEGIN:
+            CompError(MANY_BEGIN, origin);
+            exit(1);
+        default:
+            printf("Compilation error\n");
+            exit(1);
+    }
+}
+
+#if defined(__x86_64__) && defined(__unix__)
+
+/// Baseline x86-64 compiler of the register form (see translator.h).
+/// rbx points to the frame, rbp to JitContext,
+/// user registers live in xmm8..xmm14, xmm0, xmm1 and xmm15 are scratch
+class Jit
+{
+    private:
+        unsigned char* code;
+        size_t size;
+        size_t capacity;
+        size_t* native;        /// Offset of every command of the register form
+        size_t* fixups;        /// Offsets of rel32 fields to patch
+        size_t* fixup_targets; /// Commands they lead to
+        size_t number_of_fixups;
+
+        void Byte(int byte) { code[size++] = (unsigned char)byte; }
+        void Int(int32_t value);
+        void Long(uint64_t value);
+        void Sse(int prefix, int opcode, int reg, int rm);
+        void SseMem(int prefix, int opcode, int reg, int base, int32_t disp);
+        void Load(int xmm, int slot);
+        void Store(int slot, int xmm);
+        void Arith(int opcode, int xmm, int slot);
+        void Flags();
+        void Compare(int a, int b);
+        void SaveRegs();
+        void LoadRegs();
+        void RawCall(void* func);
+        void Call(void* func);
+        void HookCall(int hook);
+        void Fail(int err, size_t origin);
+        void JumpIf(int cond, int flag, size_t target);
+        void Jump(size_t target);
+        void Epilogue();
+        void Emit(const RegInstr* instr);
+
+    public:
+        Jit()
+        {
+            code = NULL;
+            size = 0;
+            capacity = 0;
+            native = NULL;
+            fixups = NULL;
+            fixup_targets = NULL;
+            number_of_fixups = 0;
+        }
+        bool Compile(const Translator* translator);
+        void Run(double* frame, bool* ZF, bool* above_flag, const JitHooks* hooks);
+        ~Jit()
+        {
+            if(code != NULL)
+                munmap(code, capacity);
+            delete [] native;
+            delete [] fixups;
+            delete [] fixup_targets;
+        }
+};
+
+void Jit::Int(int32_t value)
+{
+    memcpy(code + size, &value, sizeof(value));
+    size += sizeof(value);
+}
+
+void Jit::Long(uint64_t value)
+{
+    memcpy(code + size, &value, sizeof(value));
+    size += sizeof(value);
+}
+
+/// prefix [REX] 0F opcode ModRM, both operands are registers
+void Jit::Sse(int prefix, int opcode, int reg, int rm)
+{
+    Byte(prefix);
+    if(reg >= 8 || rm >= 8)
+        Byte(0x40 | ((reg >> 3) << 2) | (rm >> 3));
+    Byte(0x0F);
+    Byte(opcode);
+    Byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/// prefix [REX] 0F opcode ModRM disp32, memory operand is [base + disp]
+///@note base is rbx (3) or rbp (5), so SIB is never needed
+void Jit::SseMem(int prefix, int opcode, int reg, int base, int32_t disp)
+{
+    Byte(prefix);
+    if(reg >= 8)
+        Byte(0x44);
+    Byte(0x0F);
+    Byte(opcode);
+    Byte(0x80 | ((reg & 7) << 3) | base);
+    Int(disp);
+}
+
+void Jit::Load(int xmm, int slot)
+{
+    if(slot < NUMBER_OF_REGS)
+        Sse(0x66, 0x28, xmm, 8 + slot);                   // movapd xmm, xmm(8 + slot)
+    else
+        SseMem(0xF2, 0x10, xmm, 3, slot * sizeof(double)); // movsd xmm, [rbx + 8 * slot]
+}
+
+void Jit::Store(int slot, int xmm)
+{
+    if(slot < NUMBER_OF_REGS)
+        Sse(0x66, 0x28, 8 + slot, xmm);                   // movapd xmm(8 + slot), xmm
+    else
+        SseMem(0xF2, 0x11, xmm, 3, slot * sizeof(double)); // movsd [rbx + 8 * slot], xmm
+}
+
+/// addsd, subsd, mulsd, divsd xmm, slot
+void Jit::Arith(int opcode, int xmm, int slot)
+{
+    if(slot < NUMBER_OF_REGS)
+        Sse(0xF2, opcode, xmm, 8 + slot);
+    else
+        SseMem(0xF2, opcode, xmm, 3, slot * sizeof(double));
+}
+
+/// Flags of xmm0 like Compare(xmm0, 0)
+void Jit::Flags()
+{
+    SseMem(0xF2, 0x10, 15, 5, JIT_EPS);     // movsd xmm15, [rbp + eps]
+    Sse(0x66, 0x2E, 0, 15);                 // ucomisd xmm0, xmm15
+    Byte(0x0F); Byte(0x93); Byte(0x45); Byte(JIT_ABOVE); // setae [rbp + above]
+    SseMem(0xF2, 0x10, 15, 5, JIT_NEG_EPS); // movsd xmm15, [rbp + neg_eps]
+    Sse(0x66, 0x2E, 15, 0);                 // ucomisd xmm15, xmm0
+    Byte(0x0F); Byte(0x97); Byte(0xC0);     // seta al
+    Byte(0x0A); Byte(0x45); Byte(JIT_ABOVE); // or al, [rbp + above]
+    Byte(0x0F); Byte(0x94); Byte(0x45); Byte(JIT_ZF); // sete [rbp + ZF]
+}
+
+/// Flags of CMP: the difference of the slots truncated to int
+void Jit::Compare(int a, int b)
+{
+    Load(0, a);
+    Arith(0x5C, 0, b);                        // subsd xmm0, b
+    Sse(0xF2, 0x2C, 0, 0);                    // cvttsd2si eax, xmm0
+    Byte(0x85); Byte(0xC0);                   // test eax, eax
+    Byte(0x0F); Byte(0x94); Byte(0x45); Byte(JIT_ZF);    // sete [rbp + ZF]
+    Byte(0x0F); Byte(0x9F); Byte(0x45); Byte(JIT_ABOVE); // setg [rbp + above]
+}
+
+void Jit::SaveRegs()
+{
+    for(int i = 0; i < NUMBER_OF_REGS; ++i)
+        SseMem(0xF2, 0x11, 8 + i, 3, i * sizeof(double));
+}
+
+void Jit::LoadRegs()
+{
+    for(int i = 0; i < NUMBER_OF_REGS; ++i)
+        SseMem(0xF2, 0x10, 8 + i, 3, i * sizeof(double));
+}
+
+void Jit::RawCall(void* func)
+{
+    Byte(0x48); Byte(0xB8); Long((uint64_t)func); // mov rax, func
+    Byte(0xFF); Byte(0xD0);                       // call rax
+}
+
+/// Arguments must be already in rdi, esi, xmm0, xmm1
+void Jit::Call(void* func)
+{
+    SaveRegs();
+    RawCall(func);
+    LoadRegs();
+}
+
+/// owner is passed in rdi, other arguments must be already in rsi, edx
+void Jit::HookCall(int hook)
+{
+    SaveRegs();
+    Byte(0x48); Byte(0x8B); Byte(0x7D); Byte(JIT_OWNER); // mov rdi, [rbp + owner]
+    Byte(0xFF); Byte(0x55); Byte(hook);                  // call [rbp + hook]
+    LoadRegs();
+}
+
+/// JitFail never returns, so registers are not saved
+void Jit::Fail(int err, size_t origin)
+{
+    Byte(0xBF); Int(err);          // mov edi, err
+    Byte(0xBE); Int((int)origin);  // mov esi, origin
+    RawCall((void*)JitFail);
+}
+
+/// cmp byte [rbp + flag], 0; jcc target
+void Jit::JumpIf(int cond, int flag, size_t target)
+{
+    Byte(0x80); Byte(0x7D); Byte(flag); Byte(0x00);
+    Byte(0x0F); Byte(cond);
+    fixups[number_of_fixups] = size;
+    fixup_targets[number_of_fixups++] = target;
+    Int(0);
+}
+
+void Jit::Jump(size_t target)
+{
+    Byte(0xE9);
+    fixups[number_of_fixups] = size;
+    fixup_targets[number_of_fixups++] = target;
+    Int(0);
+}
+
+void Jit::Epilogue()
+{
+    SaveRegs();
+    Byte(0x48); Byte(0x83); Byte(0xC4); Byte(0x08); // add rsp, 8
+    Byte(0x5D); // pop rbp
+    Byte(0x5B); // pop rbx
+    Byte(0xC3); // ret
+}
+
+void Jit::Emit(const RegInstr* instr)
+{
+    const int JZ = 0x84;
+    const int JNZ = 0x85;
+    switch(instr->op)
+    {
+        case R_COPY:
+            Load(0, instr->a);
+            Store(instr->dst, 0);
+            break;
+        case R_ADD:
+        case R_SUB:
+        case R_MUL:
+            Load(0, instr->a);
+            Arith((instr->op == R_ADD) ? 0x58 : (instr->op == R_SUB) ? 0x5C : 0x59, 0, instr->b);
+            Store(instr->dst, 0);
+            if(instr->flags)
+                Flags();
+            break;
+        case R_DIV:
+        {
+            /// Division by the number from (-eps, eps) is an error
+            Load(1, instr->b);
+            SseMem(0xF2, 0x10, 15, 5, JIT_EPS);
+            Sse(0x66, 0x2E, 1, 15);                   // ucomisd xmm1, eps
+            Byte(0x73); size_t ok_above = size; Byte(0); // jae ok
+            SseMem(0xF2, 0x10, 15, 5, JIT_NEG_EPS);
+            Sse(0x66, 0x2E, 15, 1);                   // ucomisd neg_eps, xmm1
+            Byte(0x77); size_t ok_below = size; Byte(0); // ja ok
+            Fail(JIT_DIV_ZERO, instr->origin);
+            code[ok_above] = size - ok_above - 1;
+            code[ok_below] = size - ok_below - 1;
+            Load(0, instr->a);
+            Sse(0xF2, 0x5E, 0, 1);                    // divsd xmm0, xmm1
+            Store(instr->dst, 0);
+            if(instr->flags)
+                Flags();
+            break;
+        }
+        case R_MOD:
+            Load(0, instr->a);
+            Load(1, instr->b);
+            Call((void*)JitMod);
+            Store(instr->dst, 0);
+            if(instr->flags)
+                Flags();
+            break;
+        case R_SQRT:
+        {
+            Load(0, instr->a);
+            SseMem(0xF2, 0x10, 15, 5, JIT_NEG_EPS);
+            Sse(0x66, 0x2E, 15, 0);                   // ucomisd neg_eps, xmm0
+            Byte(0x76); size_t ok = size; Byte(0);    // jbe ok
+            Fail(JIT_NEG_SQRT, instr->origin);
+            code[ok] = size - ok - 1;
+            Sse(0xF2, 0x51, 0, 0);                    // sqrtsd xmm0, xmm0
+            Store(instr->dst, 0);
+            if(instr->flags)
+                Flags();
+            break;
+        }
+        case R_ABS:
+            Load(0, instr->a);
+            Call((void*)JitAbs);
+            Store(instr->dst, 0);
+            if(instr->flags)
+                Flags();
+            break;
+        case R_CMP:
+            if(instr->flags)
+                Compare(instr->a, instr->b);
+            break;
+        case R_CJE:
+        case R_CJNE:
+        case R_CJB:
+        case R_CJBE:
+        case R_CJA:
+        case R_CJAE:
+        {
+            Compare(instr->a, instr->b);
+            RegInstr jump = *instr;
+            jump.op = instr->op - R_CJE + R_JE;
+            Emit(&jump);
+            break;
+        }
+        case R_INPUT:
+            Byte(0x48); Byte(0x89); Byte(0xDE);       // mov rsi, rbx
+            Byte(0xBA); Int(instr->dst);              // mov edx, reg
+            HookCall(JIT_INPUT);
+            break;
+        case R_OUTPUT:
+            Byte(0x48); Byte(0x89); Byte(0xDE);       // mov rsi, rbx
+            Byte(0xBA); Int(instr->a);                // mov edx, reg
+            HookCall(JIT_OUTPUT);
+            break;
+        case R_JMP:
+            Jump(instr->target);
+            break;
+        case R_JE:
+            JumpIf(JNZ, JIT_ZF, instr->target);
+            break;
+        case R_JNE:
+            JumpIf(JZ, JIT_ZF, instr->target);
+            break;
+        case R_JB:
+            JumpIf(JZ, JIT_ABOVE, instr->target);
+            break;
+        case R_JBE:
+            JumpIf(JZ, JIT_ABOVE, instr->target);
+            JumpIf(JNZ, JIT_ZF, instr->target);
+            break;
+        case R_JA:
+            JumpIf(JNZ, JIT_ABOVE, instr->target);
+            break;
+        case R_JAE:
+            JumpIf(JNZ, JIT_ABOVE, instr->target);
+            JumpIf(JNZ, JIT_ZF, instr->target);
+            break;
+        case R_BEGIN:
+            Fail(JIT_MANY_BEGIN, instr->origin);
+            break;
+        case R_END:
+            HookCall(JIT_END);
+            Epilogue();
+            break;
+        case R_HALT:
+            Epilogue();
+            break;
+        default:
+            Fail(JIT_WRONG_COMMAND, instr->origin);
+    }
+}
+
+///@return false, if native code can't be generated
+bool Jit::Compile(const Translator* translator)
+{
+    assert(translator != NULL);
+
+    const size_t MAX_COMMAND_SIZE = 256;
+    size_t number_of_codes = translator->number_of_codes + 1;
+    capacity = (number_of_codes + 1) * MAX_COMMAND_SIZE;
+    void* memory = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED)
+        return false;
+    code = (unsigned char*)memory;
+    native = new size_t[number_of_codes];
+    fixups = new size_t[2 * number_of_codes + 1];
+    fixup_targets = new size_t[2 * number_of_codes + 1];
+
+    /// void (double* frame, JitContext* context)
+    Byte(0x53);                               // push rbx
+    Byte(0x55);                               // push rbp
+    Byte(0x48); Byte(0x83); Byte(0xEC); Byte(0x08); // sub rsp, 8 (alignment for calls)
+    Byte(0x48); Byte(0x89); Byte(0xFB);       // mov rbx, rdi
+    Byte(0x48); Byte(0x89); Byte(0xF5);       // mov rbp, rsi
+    LoadRegs();
+    Jump(translator->entry);
+
+    for(size_t i = 0; i < number_of_codes; ++i)
+    {
+        native[i] = size;
+        Emit(&translator->code[i]);
+        assert(size - native[i] <= MAX_COMMAND_SIZE);
+    }
+
+    for(size_t i = 0; i < number_of_fixups; ++i)
+    {
+        int32_t rel = native[fixup_targets[i]] - (fixups[i] + 4);
+        memcpy(code + fixups[i], &rel, sizeof(rel));
+    }
+    return mprotect(code, capacity, PROT_READ | PROT_EXEC) == 0;
+}
+
+void Jit::Run(double* frame, bool* ZF, bool* above_flag, const JitHooks* hooks)
+{
+    assert(hooks != NULL);
+
+    JitContext context = {};
+    context.hooks = *hooks;
+    context.ZF = *ZF;
+    context.above = *above_flag;
+    context.epsilon = eps;
+    context.neg_epsilon = -eps;
+
+    void (*func)(double*, JitContext*) = (void (*)(double*, JitContext*))code;
+    func(frame, &context);
+    *ZF = context.ZF;
+    *above_flag = context.above;
+}
+
+#else
+
+/// There is no native code generator for this platform
+class Jit
+{
+    public:
+        bool Compile(const Translator*) { return false; }
+        void Run(double*, bool*, bool*, const JitHooks*) {}
+};
+
+#endif
@@ -0,0 +1,170 @@
+#pragma once
+
+#include"functions.h"
+
+/// Mnemonics of commands and registers
+struct Keyword
+{
+    const char* name;
+    Flag flag;  /// CMD or REG
+    int code;   /// Command or Register
+};
+
+const size_t KEYWORD_TABLE_SIZE = 64;
+
+constexpr char KeywordUpper(char symb)
+{
+    return (symb >= 'a' && symb <= 'z') ? symb - 'a' + 'A' : symb;
+}
+
+//----------------------------------------------------------------------
+//! Function "KeywordHash" is a perfect hash of the mnemonics
+//!
+//!@param [in] data Word, it may be not NUL-terminated
+//!@param [in] len Length of the word, not 0
+//!
+//!@return Slot in KEYWORD_TABLE
+//!
+//!@note Case insensitive. KEYWORD_TABLE is laid out for this function,
+//!      the static_assert below fails if they don't match
+//----------------------------------------------------------------------
+constexpr size_t KeywordHash(const char* data, size_t len)
+{
+    return (2 * KeywordUpper(data[0])
+            + 5 * (len > 1 ? KeywordUpper(data[1]) : 0)
+            + 8 * KeywordUpper(data[len - 1])
+            + len) % KEYWORD_TABLE_SIZE;
+}
+
+constexpr Keyword KEYWORD_TABLE[KEYWORD_TABLE_SIZE] =
+{
+    {"CX", REG, CX},
+    {NULL, ERR_FLAG, 0},
+    {"DX", REG, DX},
+    {NULL, ERR_FLAG, 0},
+    {"JAE", CMD, JAE},
+    {"JNE", CMD, JNE},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"MOD", CMD, MOD},
+    {"JBE", CMD, JBE},
+    {"CMP", CMD, CMP},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"PUSH", CMD, PUSH},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"BEGIN", CMD, BEGIN},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"BP", REG, BP},
+    {"JE", CMD, JE},
+    {"JMP", CMD, JMP},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"SI", REG, SI},
+    {NULL, ERR_FLAG, 0},
+    {"SQRT", CMD, SQRT},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"SUB", CMD, SUB},
+    {"JA", CMD, JA},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"MUL", CMD, MUL},
+    {"ABS", CMD, ABS},
+    {"DIV", CMD, DIV},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"OUTPUT", CMD, OUTPUT},
+    {"POP", CMD, POP},
+    {NULL, ERR_FLAG, 0},
+    {"JB", CMD, JB},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"END", CMD, END},
+    {NULL, ERR_FLAG, 0},
+    {"DUMP", CMD, DUMP},
+    {"TOP", CMD, TOP},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"ADD", CMD, ADD},
+    {NULL, ERR_FLAG, 0},
+    {NULL, ERR_FLAG, 0},
+    {"AX", REG, AX},
+    {"INPUT", CMD, INPUT},
+    {"BX", REG, BX},
+    {"DI", REG, DI},
+};
+
+constexpr size_t KeywordLength(const char* name)
+{
+    return (*name == '\0') ? 0 : 1 + KeywordLength(name + 1);
+}
+
+constexpr bool KeywordTableIsPerfect(size_t slot)
+{
+    return slot == KEYWORD_TABLE_SIZE
+           || ((KEYWORD_TABLE[slot].name == NULL
+                || KeywordHash(KEYWORD_TABLE[slot].name, KeywordLength(KEYWORD_TABLE[slot].name)) == slot)
+               && KeywordTableIsPerfect(slot + 1));
+}
+
+static_assert(KeywordTableIsPerfect(0), "KEYWORD_TABLE doesn't match KeywordHash");
+
+//----------------------------------------------------------------------
+//! Function "FindKeyword" classifies the word with one lookup
+//!
+//!@param [in] data Word, it may be not NUL-terminated
+//!@param [in] len Length of the word
+//!
+//!@return Keyword of the command or register,
+//!        NULL, if the word is not a mnemonic
+//!
+//----------------------------------------------------------------------
+const Keyword* FindKeyword(const char* data, size_t len)
+{
+    assert(data != NULL);
+    if(len == 0)
+        return NULL;
+
+    const Keyword* keyword = &KEYWORD_TABLE[KeywordHash(data, len)];
+    if(keyword->name == NULL)
+        return NULL;
+    for(size_t i = 0; i < len; ++i)
+        if(keyword->name[i] != KeywordUpper(data[i]))
+            return NULL;
+    if(keyword->name[len] != '\0')
+        return NULL;
+    return keyword;
+}
+
+///@return Mnemonic of the command, the optimizer commands have names too
+const char* CommandName(int code)
+{
+    for(size_t i = 0; i < KEYWORD_TABLE_SIZE; ++i)
+        if(KEYWORD_TABLE[i].flag == CMD && KEYWORD_TABLE[i].code == code)
+            return KEYWORD_TABLE[i].name;
+
+    switch(code)
+    {
+        case MOV:  return "MOV";
+        case ADDI: return "ADDI";
+        case SUBI: return "SUBI";
+        case MULI: return "MULI";
+        case CJE:  return "CJE";
+        case CJNE: return "CJNE";
+        case CJB:  return "CJB";
+        case CJBE: return "CJBE";
+        case CJA:  return "CJA";
+        case CJAE: return "CJAE";
+        default:   return "???";
+    }
+}
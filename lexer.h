@@ -0,0 +1,68 @@
+#pragma once
+
+#include"functions.h"
+
+/// View of one word in the source, the text is not copied
+struct Token
+{
+    const char* start;
+    size_t len;
+    size_t line;     /// starts from 1
+    size_t column;   /// starts from 1
+};
+
+/// Splits the text by spaces, tabs and line ends one word at a time,
+/// so there is no limit for the number of words
+class Lexer
+{
+    private:
+        const char* text;
+        size_t size;
+        size_t pos;
+        size_t line;
+        size_t line_start;
+
+        bool IsSeparator(char symb) { return symb == ' ' || symb == '\t' || symb == '\n' || symb == '\r'; }
+
+    public:
+        Lexer(const char* source, size_t source_size)
+        {
+            text = source;
+            size = source_size;
+            Rewind();
+        }
+        void Rewind()
+        {
+            pos = 0;
+            line = 1;
+            line_start = 0;
+        }
+        bool Next(Token* token);
+};
+
+///@return false, if there are no more words
+bool Lexer::Next(Token* token)
+{
+    assert(token != NULL);
+
+    /// Ignoring separators
+    while(pos < size && IsSeparator(text[pos]))
+    {
+        if(text[pos] == '\n')
+        {
+            ++line;
+            line_start = pos + 1;
+        }
+        ++pos;
+    }
+    if(pos == size)
+        return false;
+
+    token->start = text + pos;
+    token->line = line;
+    token->column = pos - line_start + 1;
+    while(pos < size && !IsSeparator(text[pos]))
+        ++pos;
+    token->len = text + pos - token->start;
+    return true;
+}
@@ -4,9 +4,11 @@
 int main()
 {
     Compiler comp;
-    size_t number_of_blocks = comp.Compile("factorial.txt", "output.o");
+    Program program;
+    comp.CompileFile("factorial.txt", &program);
 
     Processor proc;
-    proc.Run("output.o", number_of_blocks);
+    proc.Load(&program);
+    proc.Execute();
     return 0;
 }
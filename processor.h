@@ -1,23 +1,95 @@
 #pragma once
 
 #include"functions.h"
-#include"declaration.h"
-const size_t MAX_ELEMS = 100;
+#include"datastack.h"
+#include"translator.h"
+#include"jit.h"
+#include"batch.h"
+#include"channels.h"
+#include"program.h"
+#include"profiler.h"
+#include"trace.h"
+#include"values.h"
+#include<type_traits>
 
-class Processor
+const size_t MAX_ELEMS = 100; /// Default depth of the stack
+
+/// Way of dispatching the commands
+enum Engine
+{
+    SWITCH_ENGINE = 0,   /// switch over cmd_code on every step
+    THREADED_ENGINE = 1, /// direct threaded code: jumps from handler to handler
+    REGISTER_ENGINE = 2, /// stack slots translated to registers (see translator.h)
+    JIT_ENGINE = 3,      /// native x86-64 code (see jit.h)
+};
+
+/// What the interpreter loops do besides running the program
+enum Watch
+{
+    WATCH_NONE = 0,
+    WATCH_PROFILE = 1,   /// counters of Profiler
+    WATCH_TRACE = 2,     /// log of TraceRecorder
+    WATCH_REPLAY = 3,    /// run checked against TraceLog
+};
+
+const int NUMBER_OF_WATCHES = WATCH_REPLAY + 1;
+
+/// Processor on numbers of type T (see values.h).
+/// Programs always come with double operands, other types get their own copy of the commands.
+/// Register form, native code and batches exist only for double,
+/// other processors run them in the switch loop
+template<class T>
+class BasicProcessor
 {
     private:
-        Stack<double> data_stack;
-        double regs[7];          // AX, BX, CX, DX, SI, DI, BP
+        typedef ValueTraits<T> Traits;
+
+        BasicDataStack<T> data_stack;
+        T regs[NUMBER_OF_REGS];  // AX, BX, CX, DX, SI, DI, BP
         size_t IP;               // Command counter, shows the next command number, starts from the 0!
-        Instruction* instrs;     // Array with commands
-        bool above_flag;         // (true) if command returns > 0
-                                 //            (false) else
-        bool ZF;                 // Zero Flag: (true) if command returns 0
-                                 //            (false) else
-
-        size_t ReadCommands(const char* in_file);
-        void CommandPush(int arg_flag, double value);
+        const Instruction* code; // Array with commands, points into the mapped object file or the program
+        const BasicInstruction<T>* instrs; // Commands with operands of type T
+        BasicInstruction<T>* decoded; // Own copy for the types other than double
+        const void** threaded[NUMBER_OF_WATCHES]; // Handler of every command in the threaded code of every watch
+        size_t number_of_commands;
+        size_t begin;            // First command after "BEGIN"
+        void* image;             // Mapped object file
+        size_t image_size;
+        T flags;                 // Last result that sets the flags, they are taken from its sign
+                                 // only by the jumps and DUMP
+        Translator* translator;  // Register form, built by the first run that needs it
+        Jit* jit;                // Native code, built by the first run that needs it
+        bool no_translation;     // Register form can't be built
+        bool no_jit;             // Native code can't be built
+        StreamChannel console;   // stdin and stdout with the prompts
+        Channel* channel;        // INPUT and OUTPUT go here
+        const Program* source;   // Program with lines and labels, NULL for object files
+        Profiler* profiler;      // Counters of the run, NULL if it is not profiled
+        TraceRecorder* recorder; // Log of the run, NULL if it is not traced
+        TraceLog* replay;        // Log of the replayed run, NULL for the usual runs
+        bool tracing;            // The recorder writes the log of this run
+
+        void LoadObject(const char* in_file);
+        void CheckCommands();
+        void Decode();
+        void DropCode();
+        const Translator* RegisterForm();
+        Jit* NativeCode();
+        void Input(T* dst);
+        void Output(int reg, T value);
+        void End();
+        static void HookInput(void* owner, double* frame, int reg);
+        static void HookOutput(void* owner, double* frame, int reg);
+        static void HookEnd(void* owner);
+        void Go(Engine engine);
+        template<int watch> void Interpret(Engine engine);
+        template<int watch> void RunSwitch();
+        template<int watch> void RunThreaded(bool decode = false);
+        void RunRegister();
+        void RunJit();
+        bool RunLanes(BatchLanes* lanes);
+        void RunLanesOneByOne(BatchLanes* lanes);
+        void CommandPush(int arg_flag, int reg, T value);
         void CommandPop(int reg);
         void CommandTop(int reg);
         void CommandAdd();
@@ -30,75 +102,477 @@ class Processor
         void CommandDump();
         void CommandAbs();
         void CommandCmp();
-        void CommandJmp(size_t address, size_t limit);
-        void CommandJe(size_t address, size_t limit);
-        void CommandJne(size_t address, size_t limit);
-        void CommandJb(size_t address, size_t limit);
-        void CommandJbe(size_t address, size_t limit);
-        void CommandJa(size_t address, size_t limit);
-        void CommandJae(size_t address, size_t limit);
+        bool CommandJmp(size_t address);
+        bool CommandJe(size_t address);
+        bool CommandJne(size_t address);
+        bool CommandJb(size_t address);
+        bool CommandJbe(size_t address);
+        bool CommandJa(size_t address);
+        bool CommandJae(size_t address);
         void CommandSqrt();
+        void CommandMov(int reg, int arg_flag, int src, T value);
+        void CommandAddi(int reg, int src, T value);
+        void CommandSubi(int reg, int src, T value);
+        void CommandMuli(int reg, int src, T value);
+        void SetFlags(T res) { flags = res; }
+        void SetOrder(T up, T down) { flags = Traits::Difference(up, down); }
+        void SetFlagBits(bool zero, bool above);
+        /// Zero Flag: (true) if the last result is 0
+        bool ZeroFlag() const { return Traits::Sign(flags) == 0; }
+        /// (true) if the last result is > 0
+        bool AboveFlag() const { return Traits::Sign(flags) > 0; }
+        /// Condition of JE..JAE on the flags
+        bool Condition(int jump) const { return JumpTaken(jump, Traits::Sign(flags)); }
+        void CommandCmpOperands(int arg_flag, int reg, int src, T value);
+
+        void Checkpoint();
+        void Diverged();
+
+        /// Calls of the other watches vanish from every instance of the loops
+        template<int watch> void Step()
+        {
+            if(watch == WATCH_PROFILE)
+                profiler->Step(IP);
+        }
+        template<int watch> void Branch(bool taken)
+        {
+            if(watch == WATCH_PROFILE)
+                profiler->Branch(taken);
+            /// IP is at the next command already, the state is whole
+            if(watch == WATCH_TRACE && recorder->Branch(taken))
+                Checkpoint();
+            if(watch == WATCH_REPLAY && (!replay->SameBranch(taken)
+               || (replay->Tick() && !replay->Check(IP, regs, ZeroFlag(), AboveFlag(),
+                                                    data_stack.Base(), data_stack.Size()))))
+                Diverged();
+        }
 
     public:
-        Processor()
+        BasicProcessor(size_t stack_size = MAX_ELEMS)
         {
-            data_stack.Create(MAX_ELEMS);
-            for(int i = 0; i < 7; ++i)
+            data_stack.Create(stack_size);
+            for(int i = 0; i < NUMBER_OF_REGS; ++i)
                 regs[i] = 0;
             IP = 0;
+            code = NULL;
             instrs = NULL;
-            above_flag = false;
-            ZF = false;
+            decoded = NULL;
+            for(int i = 0; i < NUMBER_OF_WATCHES; ++i)
+                threaded[i] = NULL;
+            number_of_commands = 0;
+            begin = 0;
+            image = NULL;
+            image_size = 0;
+            flags = Traits::FromDouble(-1);
+            translator = NULL;
+            jit = NULL;
+            no_translation = false;
+            no_jit = false;
+            channel = &console;
+            source = NULL;
+            profiler = NULL;
+            recorder = NULL;
+            replay = NULL;
+            tracing = false;
         }
-        void Run(const char* in_file, size_t number_of_blocks);
-        ~Processor()
+        void Load(const char* in_file);
+        void Load(const Program* program);
+        void Reset();
+        void Execute(Engine engine = SWITCH_ENGINE);
+        void Replay(TraceLog* log, size_t checkpoint = 0, Engine engine = SWITCH_ENGINE);
+        void Run(const char* in_file, Engine engine = SWITCH_ENGINE);
+        bool RunBatch(const char* in_file, BatchLanes* lanes);
+        bool RunBatch(const Program* program, BatchLanes* lanes);
+        void SetChannel(Channel* io) { channel = (io != NULL) ? io : &console; }
+        /// NULL turns the profiling off
+        void SetProfiler(Profiler* counters) { profiler = counters; }
+        /// NULL turns the tracing off
+        void SetRecorder(TraceRecorder* log) { recorder = log; }
+        ~BasicProcessor()
         {
-            data_stack.Destroy();
-            delete [] instrs;
+            DropCode();
+            delete [] decoded;
+            for(int i = 0; i < NUMBER_OF_WATCHES; ++i)
+                delete [] threaded[i];
+            if(image != NULL)
+                munmap(image, image_size);
         }
 };
 
-void Processor::Run(const char* in_file, size_t number_of_blocks)
+template<class T>
+void BasicProcessor<T>::Run(const char* in_file, Engine engine)
+{
+    Load(in_file);
+    Execute(engine);
+}
+
+///@note The program stays loaded for any number of Execute
+template<class T>
+void BasicProcessor<T>::Load(const char* in_file)
+{
+    DropCode();
+    LoadObject(in_file);
+    source = NULL;
+    Reset();
+}
+
+///@note Program is used in place, it must live while it is loaded
+template<class T>
+void BasicProcessor<T>::Load(const Program* program)
 {
-    instrs = new Instruction[number_of_blocks];
-    size_t number_of_commands = ReadCommands(in_file);
-    if(number_of_blocks != number_of_commands)
+    assert(program != NULL);
+
+    DropCode();
+    if(image != NULL)
+        munmap(image, image_size);
+    image = NULL;
+    image_size = 0;
+
+    code = program->Instructions();
+    number_of_commands = program->Size();
+    begin = program->Begin();
+    source = program;
+    CheckCommands();
+    Decode();
+    Reset();
+}
+
+///@note Registers, flags and stack, the channel is not touched
+template<class T>
+void BasicProcessor<T>::Reset()
+{
+    for(int i = 0; i < NUMBER_OF_REGS; ++i)
+        regs[i] = 0;
+    flags = Traits::FromDouble(-1);
+    data_stack.Clear();
+    IP = begin;
+}
+
+///@note Runs the loaded program from the command after "begin"
+///      with zero registers and the empty stack, as the compiler expects
+template<class T>
+void BasicProcessor<T>::Execute(Engine engine)
+{
+    /// Starting from the next command after "begin"
+    Reset();
+    Go(engine);
+}
+
+//-------------------------------------------------------------------
+//! Function "Replay" runs the program again as it was recorded
+//!
+//!@param [in] log Trace of the run written by TraceRecorder
+//!@param [in] checkpoint Index of the checkpoint to start from, 0 is the start of the run
+//!@param [in] engine SWITCH_ENGINE or THREADED_ENGINE, others are interpreted by the switch
+//!
+//!@note INPUT takes the recorded numbers, OUTPUT goes to the channel.
+//!      The replay stops the process if it goes the other way than the recorded run.
+//!      A run stopped by an error (see TraceLog::Failed) stops on it again
+//-------------------------------------------------------------------
+template<class T>
+void BasicProcessor<T>::Replay(TraceLog* log, size_t checkpoint, Engine engine)
+{
+    assert(log != NULL);
+
+    if(!log->Matches(code, number_of_commands, Traits::kind))
     {
-        printf("Error in reading\n");
-        std::cout << number_of_commands;
+        printf("Trace of another program\n");
+        exit(1);
+    }
+    if(checkpoint >= log->Checkpoints())
+    {
+        printf("No checkpoint %zu in the trace\n", checkpoint);
         exit(1);
     }
-    /// Starting from the word "begin"
-    while(instrs[IP].cmd_code != BEGIN)
-        ++IP;
-    if(IP == number_of_commands)
-        CompError(NO_BEGIN, 0);
 
-    IP++; // next command after "BEGIN"
-    while(IP < number_of_commands)
+    /// The state is restored, nothing before the checkpoint is executed
+    const TraceCheckpoint* state = log->Seek(checkpoint);
+    if(state->stack_size > data_stack.Capacity())
+    {
+        printf("Stack overflow\n");
+        exit(1);
+    }
+    memcpy(regs, state->regs, sizeof(regs));
+    SetFlagBits(state->zero, state->above);
+    data_stack.Restore(state->stack, state->stack_size);
+    IP = state->ip;
+
+    replay = log;
+    Go(engine);
+    replay = NULL;
+}
+
+///@note Runs from IP with the current state
+template<class T>
+void BasicProcessor<T>::Go(Engine engine)
+{
+    /// Stack faults come back here
+    GuardStack(&data_stack);
+    int fault = sigsetjmp(guarded_return, 1);
+    if(fault != 0)
     {
-        if(instrs[IP].cmd_flag != LABEL && instrs[IP].cmd_flag != CMD)
+        GuardStack(NULL);
+        printf("Stack %s\n", (fault < 0) ? "underflow" : "overflow");
+        exit(1);
+    }
+
+    /// Only the interpreters can be watched
+    if(replay != NULL)
+        Interpret<WATCH_REPLAY>(engine);
+    else if(profiler != NULL)
+    {
+        profiler->Start(code, number_of_commands, source);
+        Interpret<WATCH_PROFILE>(engine);
+        profiler->Stop();
+    }
+    else if(recorder != NULL)
+    {
+        recorder->Start(code, number_of_commands, Traits::kind);
+        tracing = true;
+        Checkpoint();
+        Interpret<WATCH_TRACE>(engine);
+        tracing = false;
+        recorder->Stop();
+    }
+    else
+    {
+        switch(engine)
         {
-            printf("Compilation error\n");
-            exit(1);
+            case SWITCH_ENGINE:
+                RunSwitch<WATCH_NONE>();
+                break;
+            case THREADED_ENGINE:
+                RunThreaded<WATCH_NONE>();
+                break;
+            case REGISTER_ENGINE:
+                RunRegister();
+                break;
+            case JIT_ENGINE:
+                RunJit();
+                break;
+            default:
+                printf("Unknown engine %d\n", engine);
+                exit(1);
         }
+    }
+    GuardStack(NULL);
+
+    /// The program may stop without END
+    channel->Flush();
+    if(profiler != NULL && replay == NULL)
+        profiler->Print();
+}
+
+template<class T>
+template<int watch>
+void BasicProcessor<T>::Interpret(Engine engine)
+{
+    if(engine == THREADED_ENGINE)
+        RunThreaded<watch>();
+    else
+        RunSwitch<watch>();
+}
 
-        if(instrs[IP].cmd_flag == LABEL)
+template<class T>
+void BasicProcessor<T>::Checkpoint()
+{
+    recorder->Checkpoint(IP, regs, ZeroFlag(), AboveFlag(), data_stack.Base(), data_stack.Size());
+}
+
+template<class T>
+void BasicProcessor<T>::Diverged()
+{
+    printf("Replay diverged at command %zu\n", IP);
+    exit(1);
+}
+
+template<class T>
+void BasicProcessor<T>::DropCode()
+{
+    delete jit;
+    delete translator;
+    jit = NULL;
+    translator = NULL;
+    no_jit = false;
+    no_translation = false;
+}
+
+///@return Register form of the program, NULL if the stack depth is not static
+template<class T>
+const Translator* BasicProcessor<T>::RegisterForm()
+{
+    if(translator == NULL && !no_translation)
+    {
+        translator = new Translator;
+        if(!translator->Translate(code, number_of_commands, begin, data_stack.Capacity()))
         {
-            ++IP;
-            continue;
+            delete translator;
+            translator = NULL;
+            no_translation = true;
         }
-        /// Command
+    }
+    return translator;
+}
+
+///@return Native code of the program, NULL if it can't be built
+template<class T>
+Jit* BasicProcessor<T>::NativeCode()
+{
+    if(jit == NULL && !no_jit)
+    {
+        const Translator* form = RegisterForm();
+        jit = new Jit;
+        if(form == NULL || !jit->Compile(form))
+        {
+            delete jit;
+            jit = NULL;
+            no_jit = true;
+        }
+    }
+    return jit;
+}
+
+///@note Channels carry doubles, they are converted here
+template<class T>
+void BasicProcessor<T>::Input(T* dst)
+{
+    /// The replay reads the numbers of the recorded run
+    double value = 0;
+    bool read = (replay != NULL) ? replay->NextInput(&value) : channel->Read(&value);
+    if(!read)
+    {
+        printf("No more input\n");
+        exit(1);
+    }
+    if(tracing)
+        recorder->Input(value);
+    *dst = Traits::FromDouble(value);
+}
+
+template<class T>
+void BasicProcessor<T>::Output(int reg, T value)
+{
+    channel->Write(reg, Traits::ToDouble(value));
+}
+
+template<class T>
+void BasicProcessor<T>::End()
+{
+    channel->End();
+}
+
+/// Calls from the native code, its frame is always of double
+template<class T>
+void BasicProcessor<T>::HookInput(void* owner, double* frame, int reg)
+{
+    T value = T();
+    ((BasicProcessor*)owner)->Input(&value);
+    frame[reg] = Traits::ToDouble(value);
+}
+
+template<class T>
+void BasicProcessor<T>::HookOutput(void* owner, double* frame, int reg)
+{
+    ((BasicProcessor*)owner)->Output(reg, Traits::FromDouble(frame[reg]));
+}
+
+template<class T>
+void BasicProcessor<T>::HookEnd(void* owner)
+{
+    ((BasicProcessor*)owner)->End();
+}
+
+//-------------------------------------------------------------------
+//! Function "RunBatch" runs the program over many inputs at once
+//!
+//!@param [in] in_file Name of the object file
+//!@param [in, out] lanes Inputs and results of every lane, see batch.h
+//!
+//!@return true, if the lanes shared the slots of the register form,
+//!        false, if they were run one by one: the stack depth is not static
+//!        (or DUMP is used), or the numbers are not double
+//!
+//!@note The lanes run one by one stop the process on a VM error as Execute does
+//-------------------------------------------------------------------
+template<class T>
+bool BasicProcessor<T>::RunBatch(const char* in_file, BatchLanes* lanes)
+{
+    assert(lanes != NULL);
+
+    Load(in_file);
+    return RunLanes(lanes);
+}
+
+///@note Program is used in place, it must live while it is loaded
+template<class T>
+bool BasicProcessor<T>::RunBatch(const Program* program, BatchLanes* lanes)
+{
+    assert(lanes != NULL);
+
+    Load(program);
+    return RunLanes(lanes);
+}
+
+template<class T>
+bool BasicProcessor<T>::RunLanes(BatchLanes* lanes)
+{
+    RunLanesOneByOne(lanes);
+    return false;
+}
+
+template<>
+bool BasicProcessor<double>::RunLanes(BatchLanes* lanes)
+{
+    const Translator* form = RegisterForm();
+    if(form == NULL)
+    {
+        RunLanesOneByOne(lanes);
+        return false;
+    }
+
+    BatchGroup group(form, lanes);
+    for(size_t first = 0; first < lanes->number; first += BATCH_WIDTH)
+        group.Run(first);
+    return true;
+}
+
+///@note Every lane is a usual run with its own numbers
+template<class T>
+void BasicProcessor<T>::RunLanesOneByOne(BatchLanes* lanes)
+{
+    Channel* io = channel;
+    SpanChannel span;
+    channel = &span;
+    for(size_t i = 0; i < lanes->number; ++i)
+    {
+        span.Set(lanes->inputs + i * lanes->inputs_per_lane, lanes->inputs_per_lane,
+                 lanes->outputs + i * lanes->outputs_per_lane, lanes->outputs_per_lane);
+        Execute(THREADED_ENGINE);
+        lanes->output_counts[i] = span.Written();
+        lanes->errors[i] = LANE_OK;
+    }
+    channel = io;
+}
+
+template<class T>
+template<int watch>
+void BasicProcessor<T>::RunSwitch()
+{
+    while(IP < number_of_commands)
+    {
+        Step<watch>();
+
+        /// Jumps move IP themselves
         switch(instrs[IP].cmd_code)
         {
             case PUSH:
-                CommandPush(instrs[IP].arg_flag, instrs[IP].value);
+                CommandPush(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].value);
                 break;
             case POP:
-                CommandPop((int)instrs[IP].value);
+                CommandPop(instrs[IP].reg);
                 break;
             case TOP:
-                CommandTop((int)instrs[IP].value);
+                CommandTop(instrs[IP].reg);
                 break;
             case ADD:
                 CommandAdd();
@@ -116,35 +590,35 @@ void Processor::Run(const char* in_file, size_t number_of_blocks)
                 CommandMod();
                 break;
             case INPUT:
-                CommandInput((int)instrs[IP].value);
+                CommandInput(instrs[IP].reg);
                 break;
             case OUTPUT:
-                CommandOutput((int)instrs[IP].value);
+                CommandOutput(instrs[IP].reg);
                 break;
             case DUMP:
                 CommandDump();
                 break;
             case JMP:
-                CommandJmp((int)instrs[IP].value, number_of_commands);
-                break;
+                CommandJmp(instrs[IP].address);
+                continue;
             case JE:
-                CommandJe((int)instrs[IP].value, number_of_commands);
-                break;
+                Branch<watch>(CommandJe(instrs[IP].address));
+                continue;
             case JNE:
-                CommandJne((int)instrs[IP].value, number_of_commands);
-                break;
+                Branch<watch>(CommandJne(instrs[IP].address));
+                continue;
             case JB:
-                CommandJb((int)instrs[IP].value, number_of_commands);
-                break;
+                Branch<watch>(CommandJb(instrs[IP].address));
+                continue;
             case JBE:
-                CommandJbe((int)instrs[IP].value, number_of_commands);
-                break;
+                Branch<watch>(CommandJbe(instrs[IP].address));
+                continue;
             case JA:
-                CommandJa((int)instrs[IP].value, number_of_commands);
-                break;
+                Branch<watch>(CommandJa(instrs[IP].address));
+                continue;
             case JAE:
-                CommandJae((int)instrs[IP].value, number_of_commands);
-                break;
+                Branch<watch>(CommandJae(instrs[IP].address));
+                continue;
             case CMP:
                 CommandCmp();
                 break;
@@ -152,7 +626,7 @@ void Processor::Run(const char* in_file, size_t number_of_blocks)
                 CompError(MANY_BEGIN, IP);
                 break;
             case END:
-                printf("End of the program\n");
+                End();
                 return;
             case SQRT:
                 CommandSqrt();
@@ -160,6 +634,42 @@ void Processor::Run(const char* in_file, size_t number_of_blocks)
             case ABS:
                 CommandAbs();
                 break;
+            case MOV:
+                CommandMov(instrs[IP].reg, instrs[IP].arg_flag, instrs[IP].src, instrs[IP].value);
+                break;
+            case ADDI:
+                CommandAddi(instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                break;
+            case SUBI:
+                CommandSubi(instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                break;
+            case MULI:
+                CommandMuli(instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                break;
+            case CJE:
+                CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                Branch<watch>(CommandJe(instrs[IP].address));
+                continue;
+            case CJNE:
+                CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                Branch<watch>(CommandJne(instrs[IP].address));
+                continue;
+            case CJB:
+                CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                Branch<watch>(CommandJb(instrs[IP].address));
+                continue;
+            case CJBE:
+                CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                Branch<watch>(CommandJbe(instrs[IP].address));
+                continue;
+            case CJA:
+                CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                Branch<watch>(CommandJa(instrs[IP].address));
+                continue;
+            case CJAE:
+                CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+                Branch<watch>(CommandJae(instrs[IP].address));
+                continue;
             default:
                 printf("%d\n", instrs[IP].cmd_code);
                 exit(1);
@@ -168,379 +678,578 @@ void Processor::Run(const char* in_file, size_t number_of_blocks)
     }
 }
 
-size_t Processor::ReadCommands(const char* in_file)
+#ifdef __GNUC__
+//-------------------------------------------------------------------
+//! Function "RunThreaded" runs the program by the direct threaded code
+//!
+//!@param [in] decode Only build the handler table of the loaded program
+//!
+//!@note Handlers are labels of this function, so Decode calls it
+//!      with decode to get their addresses once for every program
+//-------------------------------------------------------------------
+template<class T>
+template<int watch>
+void BasicProcessor<T>::RunThreaded(bool decode)
 {
-    /// Checking correctness of entry
-    assert(in_file != NULL);
-    int num = 0;
-    FILE* in = fopen(in_file, "r");
-    while(fscanf(in, "%d %d %d %lg\n", &instrs[num].cmd_flag, &instrs[num].cmd_code, &instrs[num].arg_flag, &instrs[num].value) == 4)
-        ++num;
-    fclose(in);
-    return num;
+    if(decode)
+    {
+        /// Pre-decoding: every command is replaced with the address of its handler.
+        /// Extra slot stops the program when a jump leads past the last command.
+        delete [] threaded[watch];
+        const void** handler = new const void*[number_of_commands + 1];
+        for(size_t i = 0; i < number_of_commands; ++i)
+        {
+            switch(instrs[i].cmd_code)
+            {
+                case PUSH:   handler[i] = &&do_push;   break;
+                case POP:    handler[i] = &&do_pop;    break;
+                case TOP:    handler[i] = &&do_top;    break;
+                case ADD:    handler[i] = &&do_add;    break;
+                case SUB:    handler[i] = &&do_sub;    break;
+                case MUL:    handler[i] = &&do_mul;    break;
+                case DIV:    handler[i] = &&do_div;    break;
+                case MOD:    handler[i] = &&do_mod;    break;
+                case INPUT:  handler[i] = &&do_input;  break;
+                case OUTPUT: handler[i] = &&do_output; break;
+                case DUMP:   handler[i] = &&do_dump;   break;
+                case JMP:    handler[i] = &&do_jmp;    break;
+                case JE:     handler[i] = &&do_je;     break;
+                case JNE:    handler[i] = &&do_jne;    break;
+                case JB:     handler[i] = &&do_jb;     break;
+                case JBE:    handler[i] = &&do_jbe;    break;
+                case JA:     handler[i] = &&do_ja;     break;
+                case JAE:    handler[i] = &&do_jae;    break;
+                case CMP:    handler[i] = &&do_cmp;    break;
+                case BEGIN:  handler[i] = &&do_begin;  break;
+                case END:    handler[i] = &&do_end;    break;
+                case SQRT:   handler[i] = &&do_sqrt;   break;
+                case ABS:    handler[i] = &&do_abs;    break;
+                case MOV:    handler[i] = &&do_mov;    break;
+                case ADDI:   handler[i] = &&do_addi;   break;
+                case SUBI:   handler[i] = &&do_subi;   break;
+                case MULI:   handler[i] = &&do_muli;   break;
+                case CJE:    handler[i] = &&do_cje;    break;
+                case CJNE:   handler[i] = &&do_cjne;   break;
+                case CJB:    handler[i] = &&do_cjb;    break;
+                case CJBE:   handler[i] = &&do_cjbe;   break;
+                case CJA:    handler[i] = &&do_cja;    break;
+                case CJAE:   handler[i] = &&do_cjae;   break;
+                default:     handler[i] = &&do_unknown;
+            }
+        }
+        handler[number_of_commands] = &&do_halt;
+        threaded[watch] = handler;
+        return;
+    }
+
+    const void* const* handler = threaded[watch];
+
+    #define DISPATCH() Step<watch>(); goto *handler[IP]
+    #define NEXT() ++IP; DISPATCH()
+    /// Both ways have their own dispatch: the compiler can't turn the jump into a data dependency
+    #define JUMP_IF(cond) if(cond) { IP = instrs[IP].address; Branch<watch>(true); DISPATCH(); } \
+                          ++IP; Branch<watch>(false); DISPATCH()
+
+    DISPATCH();
+
+    do_push:
+        CommandPush(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].value);
+        NEXT();
+    do_pop:
+        CommandPop(instrs[IP].reg);
+        NEXT();
+    do_top:
+        CommandTop(instrs[IP].reg);
+        NEXT();
+    do_add:
+        CommandAdd();
+        NEXT();
+    do_sub:
+        CommandSub();
+        NEXT();
+    do_mul:
+        CommandMul();
+        NEXT();
+    do_div:
+        CommandDiv();
+        NEXT();
+    do_mod:
+        CommandMod();
+        NEXT();
+    do_input:
+        CommandInput(instrs[IP].reg);
+        NEXT();
+    do_output:
+        CommandOutput(instrs[IP].reg);
+        NEXT();
+    do_dump:
+        CommandDump();
+        NEXT();
+    do_jmp:
+        CommandJmp(instrs[IP].address);
+        DISPATCH();
+    do_je:
+        JUMP_IF(Condition(JE));
+    do_jne:
+        JUMP_IF(Condition(JNE));
+    do_jb:
+        JUMP_IF(Condition(JB));
+    do_jbe:
+        JUMP_IF(Condition(JBE));
+    do_ja:
+        JUMP_IF(Condition(JA));
+    do_jae:
+        JUMP_IF(Condition(JAE));
+    do_cmp:
+        CommandCmp();
+        NEXT();
+    do_sqrt:
+        CommandSqrt();
+        NEXT();
+    do_abs:
+        CommandAbs();
+        NEXT();
+    do_mov:
+        CommandMov(instrs[IP].reg, instrs[IP].arg_flag, instrs[IP].src, instrs[IP].value);
+        NEXT();
+    do_addi:
+        CommandAddi(instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        NEXT();
+    do_subi:
+        CommandSubi(instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        NEXT();
+    do_muli:
+        CommandMuli(instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        NEXT();
+    do_cje:
+        CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        JUMP_IF(Condition(JE));
+    do_cjne:
+        CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        JUMP_IF(Condition(JNE));
+    do_cjb:
+        CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        JUMP_IF(Condition(JB));
+    do_cjbe:
+        CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        JUMP_IF(Condition(JBE));
+    do_cja:
+        CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        JUMP_IF(Condition(JA));
+    do_cjae:
+        CommandCmpOperands(instrs[IP].arg_flag, instrs[IP].reg, instrs[IP].src, instrs[IP].value);
+        JUMP_IF(Condition(JAE));
+    do_begin:
+        CompError(MANY_BEGIN, IP);
+        NEXT();
+    do_end:
+        End();
+    do_halt:
+        return;
+    do_unknown:
+        printf("%d\n", instrs[IP].cmd_code);
+        exit(1);
+
+    #undef JUMP_IF
+    #undef NEXT
+    #undef DISPATCH
+}
+#else
+/// Computed goto is a GNU extension, other compilers use the switch loop
+template<class T>
+template<int watch>
+void BasicProcessor<T>::RunThreaded(bool decode)
+{
+    if(!decode)
+        RunSwitch<watch>();
 }
+#endif
 
-void Processor::CommandPush(int arg_flag, double value)
+///@note The register form is built for double only
+template<class T>
+void BasicProcessor<T>::RunRegister()
 {
-    bool check = 0;
-    if(arg_flag == REG)
-        switch((int)value)
+    RunSwitch<WATCH_NONE>();
+}
+
+///@note Programs without static stack depth are interpreted
+template<>
+void BasicProcessor<double>::RunRegister()
+{
+    const Translator* form = RegisterForm();
+    if(form == NULL)
+    {
+        RunSwitch<WATCH_NONE>();
+        return;
+    }
+
+    const RegInstr* code = form->code;
+    double* frame = form->frame;
+    for(int i = 0; i < NUMBER_OF_REGS; ++i)
+        frame[i] = regs[i];
+
+    size_t pos = form->entry;
+    while(true)
+    {
+        const RegInstr* cur = &code[pos];
+        ++pos;
+        switch(cur->op)
         {
-            case AX:
-                check = data_stack.Push(regs[0]);
+            case R_COPY:
+                frame[cur->dst] = frame[cur->a];
+                break;
+            case R_ADD:
+                frame[cur->dst] = frame[cur->a] + frame[cur->b];
+                SetFlags(frame[cur->dst]);
+                break;
+            case R_SUB:
+                frame[cur->dst] = frame[cur->a] - frame[cur->b];
+                SetFlags(frame[cur->dst]);
+                break;
+            case R_MUL:
+                frame[cur->dst] = frame[cur->a] * frame[cur->b];
+                SetFlags(frame[cur->dst]);
+                break;
+            case R_DIV:
+                if(Compare(frame[cur->b], 0) == 0)
+                {
+                    printf("Can't divide by 0");
+                    exit(1);
+                }
+                frame[cur->dst] = frame[cur->a] / frame[cur->b];
+                SetFlags(frame[cur->dst]);
+                break;
+            case R_MOD:
+                if(Compare(frame[cur->b], 0) == 0)
+                {
+                    printf("Can't divide by 0");
+                    exit(1);
+                }
+                frame[cur->dst] = (int)frame[cur->a] % (int)frame[cur->b];
+                SetFlags(frame[cur->dst]);
                 break;
-            case BX:
-                check = data_stack.Push(regs[1]);
+            case R_SQRT:
+                if(Compare(frame[cur->a], 0) == -1)
+                {
+                    printf("Can't extract square root from negative number\n");
+                    exit(1);
+                }
+                frame[cur->dst] = sqrt(frame[cur->a]);
+                SetFlags(frame[cur->dst]);
                 break;
-            case CX:
-                check = data_stack.Push(regs[2]);
+            case R_ABS:
+                frame[cur->dst] = fabs(frame[cur->a]);
+                SetFlags(frame[cur->dst]);
                 break;
-            case DX:
-                check = data_stack.Push(regs[3]);
+            case R_CMP:
+                SetOrder(frame[cur->a], frame[cur->b]);
                 break;
-            case SI:
-                check = data_stack.Push(regs[4]);
+            case R_INPUT:
+                Input(&frame[cur->dst]);
                 break;
-            case DI:
-                check = data_stack.Push(regs[5]);
+            case R_OUTPUT:
+                Output(cur->a, frame[cur->a]);
                 break;
-            case BP:
-                check = data_stack.Push(regs[6]);
+            case R_CJE:
+            case R_CJNE:
+            case R_CJB:
+            case R_CJBE:
+            case R_CJA:
+            case R_CJAE:
+                SetOrder(frame[cur->a], frame[cur->b]);
+                if(Condition(cur->op - R_CJE + JE))
+                    pos = cur->target;
                 break;
+            case R_JMP:
+                pos = cur->target;
+                break;
+            case R_JE:
+                if(Condition(JE))
+                    pos = cur->target;
+                break;
+            case R_JNE:
+                if(Condition(JNE))
+                    pos = cur->target;
+                break;
+            case R_JB:
+                if(Condition(JB))
+                    pos = cur->target;
+                break;
+            case R_JBE:
+                if(Condition(JBE))
+                    pos = cur->target;
+                break;
+            case R_JA:
+                if(Condition(JA))
+                    pos = cur->target;
+                break;
+            case R_JAE:
+                if(Condition(JAE))
+                    pos = cur->target;
+                break;
+            case R_BEGIN:
+                CompError(MANY_BEGIN, cur->origin);
+                break;
+            case R_END:
+            case R_HALT:
+                if(cur->op == R_END)
+                    End();
+                IP = cur->origin;
+                for(int i = 0; i < NUMBER_OF_REGS; ++i)
+                    regs[i] = frame[i];
+                return;
             default:
-                printf("Push error 1\n");
+                printf("Compilation error\n");
                 exit(1);
         }
-    else
-        check = data_stack.Push(value);
-    if(!check)
-    {
-        printf("Push error 2\n");
-        exit(1);
     }
 }
 
-void Processor::CommandPop(int reg)
+///@note Native code works on double only
+template<class T>
+void BasicProcessor<T>::RunJit()
+{
+    RunSwitch<WATCH_NONE>();
+}
+
+///@note Programs that can't be translated or compiled are interpreted
+template<>
+void BasicProcessor<double>::RunJit()
 {
-    bool check = false;
-    switch(reg)
+    Jit* native = NativeCode();
+    if(native == NULL)
     {
-        case AX:
-            check = data_stack.Pop(&regs[0]);
-            break;
-        case BX:
-            check = data_stack.Pop(&regs[1]);
-            break;
-        case CX:
-            check = data_stack.Pop(&regs[2]);
-            break;
-        case DX:
-            check = data_stack.Pop(&regs[3]);
-            break;
-        case SI:
-            check = data_stack.Pop(&regs[4]);
-            break;
-        case DI:
-            check = data_stack.Pop(&regs[5]);
-            break;
-        case BP:
-            check = data_stack.Pop(&regs[6]);
-            break;
-        default:
-            printf("Pop error 1\n");
-            exit(1);
+        RunSwitch<WATCH_NONE>();
+        return;
     }
-    if(!check)
+
+    JitHooks hooks = {this, HookInput, HookOutput, HookEnd};
+    double* frame = translator->frame;
+    for(int i = 0; i < NUMBER_OF_REGS; ++i)
+        frame[i] = regs[i];
+    bool zero = ZeroFlag();
+    bool above = AboveFlag();
+    native->Run(frame, &zero, &above, &hooks);
+    SetFlagBits(zero, above);
+    for(int i = 0; i < NUMBER_OF_REGS; ++i)
+        regs[i] = frame[i];
+}
+
+template<class T>
+void BasicProcessor<T>::LoadObject(const char* in_file)
+{
+    /// Checking correctness of entry
+    assert(in_file != NULL);
+
+    /// Instructions are used in place, without any parsing
+    if(image != NULL)
+        munmap(image, image_size);
+    image = (void*)MapFile(in_file, &image_size);
+    const char* error = ObjectError(image, image_size);
+    if(error != NULL)
     {
-        printf("Pop error 2\n");
+        printf("Object file error: %s: %s\n", in_file, error);
         exit(1);
     }
+
+    const ObjectHeader* header = (const ObjectHeader*)image;
+    number_of_commands = header->number_of_instructions;
+    code = (const Instruction*)(header + 1);
+    begin = header->begin;
+    CheckCommands();
+    Decode();
 }
 
-void Processor::CommandTop(int reg)
+//-------------------------------------------------------------------
+//! Function "CheckCommands" verifies the program once at load
+//!
+//!@note Registers and addresses are checked on every command.
+//!      A program with the same stack depth on all paths is rejected
+//!      if a reachable command goes out of the stack (see StackDepths),
+//!      faults of the other programs are caught by the guard pages
+//-------------------------------------------------------------------
+template<class T>
+void BasicProcessor<T>::CheckCommands()
 {
-    bool check = false;
-    switch(reg)
+    if(begin > number_of_commands)
+        CompError(NO_BEGIN, 0);
+
+    /// Register operands are used as indices without any checks later
+    for(size_t i = 0; i < number_of_commands; ++i)
     {
-        case AX:
-            check = data_stack.Top(&regs[0]);
-            break;
-        case BX:
-            check = data_stack.Top(&regs[1]);
-            break;
-        case CX:
-            check = data_stack.Top(&regs[2]);
-            break;
-        case DX:
-            check = data_stack.Top(&regs[3]);
-            break;
-        case SI:
-            check = data_stack.Top(&regs[4]);
-            break;
-        case DI:
-            check = data_stack.Top(&regs[5]);
-            break;
-        case BP:
-            check = data_stack.Top(&regs[6]);
-            break;
-        default:
-            printf("Top error 1\n");
+        bool uses_reg = false;
+        bool uses_src = false;
+        if(code[i].cmd_flag != CMD)
+        {
+            printf("Object file error: command %zu: not a command\n", i);
+            exit(1);
+        }
+        else if(!RegisterOperands(&code[i], &uses_reg, &uses_src))
+        {
+            printf("Object file error: command %zu: unknown command %d\n", i, code[i].cmd_code);
+            exit(1);
+        }
+        else if(uses_reg && (code[i].reg < 0 || code[i].reg >= NUMBER_OF_REGS))
+        {
+            printf("Object file error: command %zu: wrong register %d\n", i, code[i].reg);
             exit(1);
+        }
+        else if(uses_src && (code[i].src < 0 || code[i].src >= NUMBER_OF_REGS))
+        {
+            printf("Object file error: command %zu: wrong source register %d\n", i, code[i].src);
+            exit(1);
+        }
+        else if(IsJump(code[i].cmd_code)
+                && (code[i].address < 0 || (size_t)code[i].address > number_of_commands))
+        {
+            printf("Object file error: command %zu: wrong address %d\n", i, code[i].address);
+            exit(1);
+        }
     }
-    if(!check)
+
+    int* depth = new int[number_of_commands + 1];
+    size_t fault = number_of_commands;
+    StackDepths(code, number_of_commands, begin, depth, data_stack.Capacity(), &fault);
+    if(fault < number_of_commands)
     {
-        printf("Top error 2\n");
+        int need = 0;
+        int delta = 0;
+        StackEffect(code[fault].cmd_code, &need, &delta);
+        printf("Object file error: command %zu: stack %s\n", fault, (depth[fault] < need) ? "underflow" : "overflow");
         exit(1);
     }
+    delete [] depth;
 }
 
-void Processor::CommandAdd()
+///@note Commands of double are used as they are, others are copied with converted operands
+template<class T>
+void BasicProcessor<T>::Decode()
 {
-    bool check = false;
-    double up_arg = 0;
-    double down_arg = 0;
-    check = data_stack.Pop(&down_arg);
-    if(!check)
-    {
-        printf("Add error 1\n");
-        exit(1);
-    }
-    check = data_stack.Pop(&up_arg);
-    if(!check)
-    {
-        printf("Add error 2\n");
-        exit(1);
-    }
-    double res = up_arg + down_arg;
-    check = data_stack.Push(res);
-    if(!check)
-    {
-        printf("Add error 3\n");
-        exit(1);
-    }
-    int ret = Compare(res, 0);
-    if(ret == 0)
-        ZF = true;
-    else ZF = false;
-    if(ret > 0)
-        above_flag = true;
-    else above_flag = false;
-}
-
-void Processor::CommandSub()
-{
-    bool check = false;
-    double up_arg = 0;
-    double down_arg = 0;
-    check = data_stack.Pop(&down_arg);
-    if(!check)
-    {
-        printf("Sub error 1\n");
-        exit(1);
-    }
-    check = data_stack.Pop(&up_arg);
-    if(!check)
-    {
-        printf("Sub error 2\n");
-        exit(1);
-    }
-    double res = up_arg - down_arg;
-    check = data_stack.Push(res);
-    if(!check)
-    {
-        printf("Sub error 3\n");
-        exit(1);
-    }
-    int ret = Compare(res, 0);
-    if(ret == 0)
-        ZF = true;
-    else ZF = false;
-    if(ret > 0)
-        above_flag = true;
-    else above_flag = false;
-}
-
-void Processor::CommandMul()
-{
-    bool check = false;
-    double up_arg = 0;
-    double down_arg = 0;
-    check = data_stack.Pop(&down_arg);
-    if(!check)
-    {
-        printf("Mul error 1\n");
-        exit(1);
-    }
-    check = data_stack.Pop(&up_arg);
-    if(!check)
-    {
-        printf("Mul error 2\n");
-        exit(1);
-    }
-    double res = up_arg * down_arg;
-    check = data_stack.Push(res);
-    if(!check)
-    {
-        printf("Mul error 3\n");
-        exit(1);
-    }
-    int ret = Compare(res, 0);
-    if(ret == 0)
-        ZF = true;
-    else ZF = false;
-    if(ret > 0)
-        above_flag = true;
-    else above_flag = false;
-}
-
-void Processor::CommandDiv()
-{
-    bool check = false;
-    double up_arg = 0;
-    double down_arg = 0;
-    check = data_stack.Pop(&down_arg);
-    if(!check)
+    delete [] decoded;
+    decoded = NULL;
+    if(std::is_same<T, double>::value)
+        instrs = (const BasicInstruction<T>*)code;
+    else
     {
-        printf("Div error 1\n");
-        exit(1);
+        decoded = new BasicInstruction<T>[number_of_commands + 1]();
+        for(size_t i = 0; i < number_of_commands; ++i)
+        {
+            decoded[i].cmd_flag = code[i].cmd_flag;
+            decoded[i].cmd_code = code[i].cmd_code;
+            decoded[i].arg_flag = code[i].arg_flag;
+            decoded[i].reg = code[i].reg;
+            decoded[i].value = Traits::FromDouble(code[i].value);
+            decoded[i].src = code[i].src;
+            decoded[i].address = code[i].address;
+        }
+        instrs = decoded;
     }
-    if(Compare(down_arg, 0) == 0)
+
+    /// Every watch has its own instance of the threaded loop
+    RunThreaded<WATCH_NONE>(true);
+    RunThreaded<WATCH_PROFILE>(true);
+    RunThreaded<WATCH_TRACE>(true);
+    RunThreaded<WATCH_REPLAY>(true);
+}
+
+///@note Stack faults are caught by the guard pages, see datastack.h
+template<class T>
+void BasicProcessor<T>::CommandPush(int arg_flag, int reg, T value)
+{
+    if(arg_flag == REG)
+        data_stack.Push(regs[reg]);
+    else
+        data_stack.Push(value);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandPop(int reg)
+{
+    regs[reg] = data_stack.Pop();
+}
+
+template<class T>
+void BasicProcessor<T>::CommandTop(int reg)
+{
+    regs[reg] = data_stack.Top();
+}
+
+template<class T>
+void BasicProcessor<T>::CommandAdd()
+{
+    T down_arg = data_stack.Pop();
+    T up_arg = data_stack.Pop();
+    T res = Traits::Add(up_arg, down_arg);
+    data_stack.Push(res);
+    SetFlags(res);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandSub()
+{
+    T down_arg = data_stack.Pop();
+    T up_arg = data_stack.Pop();
+    T res = Traits::Sub(up_arg, down_arg);
+    data_stack.Push(res);
+    SetFlags(res);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandMul()
+{
+    T down_arg = data_stack.Pop();
+    T up_arg = data_stack.Pop();
+    T res = Traits::Mul(up_arg, down_arg);
+    data_stack.Push(res);
+    SetFlags(res);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandDiv()
+{
+    T down_arg = data_stack.Pop();
+    if(Traits::IsZero(down_arg))
     {
         printf("Can't divide by 0");
         exit(1);
     }
-    check = data_stack.Pop(&up_arg);
-    if(!check)
-    {
-        printf("Div error 2\n");
-        exit(1);
-    }
-    double res = up_arg / down_arg;
-    check = data_stack.Push(res);
-    if(!check)
-    {
-        printf("Div error 3\n");
-        exit(1);
-    }
-    int ret = Compare(res, 0);
-    if(ret == 0)
-        ZF = true;
-    else ZF = false;
-    if(ret > 0)
-        above_flag = true;
-    else above_flag = false;
-}
-
-void Processor::CommandMod()
-{
-    bool check = false;
-    double up_arg = 0;
-    double down_arg = 0;
-    check = data_stack.Pop(&down_arg);
-    if(!check)
-    {
-        printf("Mod error 1\n");
-        exit(1);
-    }
-    if(Compare(down_arg, 0) == 0)
+    T up_arg = data_stack.Pop();
+    T res = Traits::Div(up_arg, down_arg);
+    data_stack.Push(res);
+    SetFlags(res);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandMod()
+{
+    T down_arg = data_stack.Pop();
+    if(Traits::IsZero(down_arg))
     {
         printf("Can't divide by 0");
         exit(1);
     }
-    check = data_stack.Pop(&up_arg);
-    if(!check)
-    {
-        printf("Mod error 2\n");
-        exit(1);
-    }
-    double res = (int)up_arg % (int)down_arg;
-    check = data_stack.Push(res);
-    if(!check)
-    {
-        printf("Mod error 3\n");
-        exit(1);
-    }
-    int ret = Compare(res, 0);
-    if(ret == 0)
-        ZF = true;
-    else ZF = false;
-    if(ret > 0)
-        above_flag = true;
-    else above_flag = false;
+    T up_arg = data_stack.Pop();
+    T res = Traits::Mod(up_arg, down_arg);
+    data_stack.Push(res);
+    SetFlags(res);
 }
 
-void Processor::CommandInput(int reg)
+template<class T>
+void BasicProcessor<T>::CommandInput(int reg)
 {
-    printf("Enter a number\n");
-    switch(reg)
-    {
-        case AX:
-            std::cin >> regs[0];
-            break;
-        case BX:
-            std::cin >> regs[1];
-            break;
-        case CX:
-            std::cin >> regs[2];
-            break;
-        case DX:
-            std::cin >> regs[3];
-            break;
-        case SI:
-            std::cin >> regs[4];
-            break;
-        case DI:
-            std::cin >> regs[5];
-            break;
-        case BP:
-            std::cin >> regs[6];
-            break;
-        default:
-            printf("Input error: register %d\n", reg);
-            exit(1);
-    }
+    Input(&regs[reg]);
 }
 
-void Processor::CommandOutput(int reg)
+template<class T>
+void BasicProcessor<T>::CommandOutput(int reg)
 {
-    switch(reg)
-    {
-        case AX:
-            std::cout << "Register AX contains " << regs[0] << std::endl;
-            break;
-        case BX:
-            std::cout << "Register BX contains " << regs[1] << std::endl;
-            break;
-        case CX:
-            std::cout << "Register CX contains " << regs[2] << std::endl;
-            break;
-        case DX:
-            std::cout << "Register DX contains " << regs[3] << std::endl;
-            break;
-        case SI:
-            std::cout << "Register SI contains " << regs[4] << std::endl;
-            break;
-        case DI:
-            std::cout << "Register DI contains " << regs[5] << std::endl;
-            break;
-        case BP:
-            std::cout << "Register BP contains " << regs[6] << std::endl;
-            break;
-        default:
-            printf("Output error\n");
-            exit(1);
-    }
+    Output(reg, regs[reg]);
 }
 
-void Processor::CommandDump()
+template<class T>
+void BasicProcessor<T>::CommandDump()
 {
-    bool check = false;
-    check = data_stack.Dump();
-    if(!check)
-    {
-        printf("Dump error\n");
-        exit(1);
-    }
+    data_stack.Dump();
     std::cout << "Register AX contains " << regs[0] << std::endl;
     std::cout << "Register BX contains " << regs[1] << std::endl;
     std::cout << "Register CX contains " << regs[2] << std::endl;
@@ -549,166 +1258,160 @@ void Processor::CommandDump()
     std::cout << "Register DI contains " << regs[5] << std::endl;
     std::cout << "Register BP contains " << regs[6] << std::endl;
     std::cout << "Register IP is on the " << IP << " command" << std::endl;
-    std::cout << "Zero Flag is " << ZF << std::endl << std::endl;
-    std::cout << "Above flag is " << above_flag << std::endl << std::endl;
+    std::cout << "Zero Flag is " << ZeroFlag() << std::endl << std::endl;
+    std::cout << "Above flag is " << AboveFlag() << std::endl << std::endl;
 }
 
-void Processor::CommandJmp(size_t address, size_t limit)
+///@note Addresses of all jumps are checked by LoadObject
+///@return true, if the jump is taken
+template<class T>
+bool BasicProcessor<T>::CommandJmp(size_t address)
 {
-    if(address < 0 || address > limit)
-    {
-        printf("Wrong label\n");
-        exit(1);
-    }
     IP = address;
+    return true;
 }
 
-void Processor::CommandJe(size_t address, size_t limit)
+template<class T>
+bool BasicProcessor<T>::CommandJe(size_t address)
 {
-    if(address < 0 || address > limit)
-    {
-        printf("Wrong label\n");
-        exit(1);
-    }
-    if(ZF == true)
+    bool taken = Condition(JE);
+    if(taken)
         IP = address;
+    else
+        ++IP;
+    return taken;
 }
 
-void Processor::CommandJne(size_t address, size_t limit)
+template<class T>
+bool BasicProcessor<T>::CommandJne(size_t address)
 {
-    if(address < 0 || address > limit)
-    {
-        printf("Wrong label\n");
-        exit(1);
-    }
-    if(ZF == false)
+    bool taken = Condition(JNE);
+    if(taken)
         IP = address;
+    else
+        ++IP;
+    return taken;
 }
 
-void Processor::CommandJb(size_t address, size_t limit)
+template<class T>
+bool BasicProcessor<T>::CommandJb(size_t address)
 {
-    if(address < 0 || address > limit)
-    {
-        printf("Wrong label\n");
-        exit(1);
-    }
-    if(above_flag == false)
+    bool taken = Condition(JB);
+    if(taken)
         IP = address;
+    else
+        ++IP;
+    return taken;
 }
 
-void Processor::CommandJbe(size_t address, size_t limit)
+template<class T>
+bool BasicProcessor<T>::CommandJbe(size_t address)
 {
-    if(address < 0 || address > limit)
-    {
-        printf("Wrong label\n");
-        exit(1);
-    }
-    if(above_flag == false || ZF == true)
+    bool taken = Condition(JBE);
+    if(taken)
         IP = address;
+    else
+        ++IP;
+    return taken;
 }
 
-void Processor::CommandJa(size_t address, size_t limit)
+template<class T>
+bool BasicProcessor<T>::CommandJa(size_t address)
 {
-    if(address < 0 || address > limit)
-    {
-        printf("Wrong label\n");
-        exit(1);
-    }
-    if(above_flag == true)
+    bool taken = Condition(JA);
+    if(taken)
         IP = address;
+    else
+        ++IP;
+    return taken;
 }
 
-void Processor::CommandJae(size_t address, size_t limit)
+template<class T>
+bool BasicProcessor<T>::CommandJae(size_t address)
 {
-    if(address < 0 || address > limit)
-    {
-        printf("Wrong label\n");
-        exit(1);
-    }
-    if(above_flag == true || ZF == true)
+    bool taken = Condition(JAE);
+    if(taken)
         IP = address;
+    else
+        ++IP;
+    return taken;
 }
 
-void Processor::CommandCmp()
+template<class T>
+void BasicProcessor<T>::CommandCmp()
 {
-    bool check = false;
-    double up_arg = 0;
-    double down_arg = 0;
-    check = data_stack.Pop(&down_arg);
-    if(!check)
-    {
-        printf("Cmp error 1\n");
-        exit(1);
-    }
-    check = data_stack.Pop(&up_arg);
-    if(!check)
-    {
-        printf("Cmp error 2\n");
-        exit(1);
-    }
-    int res = up_arg - down_arg;
-    int ret = Compare(res, 0);
-    if(ret == 0)
-        ZF = true;
-    else ZF = false;
-    if(ret > 0)
-        above_flag = true;
-    else above_flag = false;
-}
-
-void Processor::CommandAbs()
-{
-    bool check = false;
-    double num = 0;
-    check = data_stack.Pop(&num);
-    if(!check)
-    {
-        printf("Abs error 1");
-        exit(1);
-    }
-    double res = abs(num);
-    check = data_stack.Push(res);
-    if(!check)
-    {
-        printf("Sqrt error 2");
-        exit(1);
-    }
-    int ret = Compare(res, 0);
-    if(ret == 0)
-        ZF = true;
-    else ZF = false;
-    if(ret > 0)
-        above_flag = true;
-    else above_flag = false;
+    T down_arg = data_stack.Pop();
+    T up_arg = data_stack.Pop();
+    SetOrder(up_arg, down_arg);
 }
 
-void Processor::CommandSqrt()
+template<class T>
+void BasicProcessor<T>::CommandAbs()
 {
-    bool check = false;
-    double num = 0;
-    check = data_stack.Pop(&num);
-    if(!check)
-    {
-        printf("Sqrt error 1");
-        exit(1);
-    }
-    if(Compare(num, 0) == -1)
+    T res = Traits::Abs(data_stack.Pop());
+    data_stack.Push(res);
+    SetFlags(res);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandSqrt()
+{
+    T num = data_stack.Pop();
+    if(Traits::IsNegative(num))
     {
         printf("Can't extract square root from negative number\n");
         exit(1);
     }
-    double res = sqrt(num);
-    check = data_stack.Push(res);
-    if(!check)
-    {
-        printf("Sqrt error 2");
-        exit(1);
-    }
-    int ret = Compare(res, 0);
-    if(ret == 0)
-        ZF = true;
-    else ZF = false;
-    if(ret > 0)
-        above_flag = true;
-    else above_flag = false;
+    T res = Traits::Sqrt(num);
+    data_stack.Push(res);
+    SetFlags(res);
+}
+
+///@note Any result with the same sign stands for the flags
+template<class T>
+void BasicProcessor<T>::SetFlagBits(bool zero, bool above)
+{
+    flags = Traits::FromDouble(zero ? 0 : above ? 1 : -1);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandMov(int reg, int arg_flag, int src, T value)
+{
+    if(arg_flag == REG)
+        regs[reg] = regs[src];
+    else
+        regs[reg] = value;
 }
+
+template<class T>
+void BasicProcessor<T>::CommandAddi(int reg, int src, T value)
+{
+    regs[reg] = Traits::Add(regs[src], value);
+    SetFlags(regs[reg]);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandSubi(int reg, int src, T value)
+{
+    regs[reg] = Traits::Sub(regs[src], value);
+    SetFlags(regs[reg]);
+}
+
+template<class T>
+void BasicProcessor<T>::CommandMuli(int reg, int src, T value)
+{
+    regs[reg] = Traits::Mul(regs[src], value);
+    SetFlags(regs[reg]);
+}
+
+///@note Sets flags like "push x / push y / cmp" without touching the stack
+template<class T>
+void BasicProcessor<T>::CommandCmpOperands(int arg_flag, int reg, int src, T value)
+{
+    T up_arg = (arg_flag == NUM_REG) ? value : regs[reg];
+    T down_arg = (arg_flag == REG_NUM) ? value : regs[src];
+    SetOrder(up_arg, down_arg);
+}
+
+typedef BasicProcessor<double> Processor;
+typedef BasicProcessor<int64_t> IntProcessor;
@@ -0,0 +1,309 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<x86intrin.h>
+#else
+#include<time.h>
+#endif
+#include"keywords.h"
+#include"program.h"
+
+/// Time stamp counter, nanoseconds where there is no rdtsc
+inline uint64_t ProfileTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+///@return true for the jumps with a condition (fused ones too)
+bool IsConditionalJump(int code)
+{
+    return (code >= JE && code <= JAE) || (code >= CJE && code <= CJAE);
+}
+
+/// Counters of one run of the interpreter (see Processor::SetProfiler).
+/// Commands are counted one by one, branches by their outcome,
+/// ticks are read only when the run goes from one label region to another
+class Profiler
+{
+    private:
+        const Instruction* instrs;
+        size_t number_of_commands;
+        const Program* source;      /// Lines and labels, NULL if unknown
+        const char** label_at;      /// First label of every address up to number_of_commands
+        FILE* out;
+
+        uint64_t* executed;         /// Number of runs of every command
+        uint64_t* taken;            /// Outcomes of every conditional jump
+        uint64_t* not_taken;
+        size_t current;             /// Command being executed
+
+        size_t* region;             /// Label region of every command
+        const char** region_names;  /// First label of every region, NULL for the start
+        uint64_t* cycles;           /// Ticks of every region
+        size_t number_of_regions;
+        size_t current_region;
+        uint64_t last_tick;
+
+        void Drop();
+        void CommandText(size_t command, char* text, size_t size);
+        const char* LabelAt(size_t address);
+
+    public:
+        Profiler(FILE* out_stream = stderr)
+        {
+            instrs = NULL;
+            number_of_commands = 0;
+            source = NULL;
+            label_at = NULL;
+            out = out_stream;
+            executed = NULL;
+            taken = NULL;
+            not_taken = NULL;
+            current = 0;
+            region = NULL;
+            region_names = NULL;
+            cycles = NULL;
+            number_of_regions = 0;
+            current_region = 0;
+            last_tick = 0;
+        }
+        void Start(const Instruction* commands, size_t number, const Program* program);
+        void Stop();
+        void Print();
+        uint64_t Total() const;
+        uint64_t Executed(size_t command) const { return executed[command]; }
+        uint64_t Taken(size_t command) const { return taken[command]; }
+        uint64_t NotTaken(size_t command) const { return not_taken[command]; }
+
+        /// IP past the last command stops the program, it is not counted
+        void Step(size_t ip)
+        {
+            if(ip >= number_of_commands)
+                return;
+            ++executed[ip];
+            current = ip;
+            if(region[ip] != current_region)
+            {
+                uint64_t now = ProfileTicks();
+                cycles[current_region] += now - last_tick;
+                last_tick = now;
+                current_region = region[ip];
+            }
+        }
+
+        /// Outcome of the jump counted by the last Step
+        void Branch(bool is_taken)
+        {
+            if(is_taken)
+                ++taken[current];
+            else
+                ++not_taken[current];
+        }
+
+        ~Profiler()
+        {
+            Drop();
+        }
+};
+
+//-------------------------------------------------------------------
+//! Function "Start" clears the counters before the run
+//!
+//!@param [in] commands Commands of the program
+//!@param [in] number Number of commands
+//!@param [in] program Lines and labels of the commands, may be NULL
+//!
+//!@note Regions start at the labels, the commands before the first label
+//!      are in the region of the start
+//-------------------------------------------------------------------
+void Profiler::Start(const Instruction* commands, size_t number, const Program* program)
+{
+    assert(commands != NULL || number == 0);
+
+    Drop();
+    instrs = commands;
+    number_of_commands = number;
+    source = program;
+    executed = new uint64_t[number_of_commands + 1]();
+    taken = new uint64_t[number_of_commands + 1]();
+    not_taken = new uint64_t[number_of_commands + 1]();
+    current = 0;
+
+    label_at = new const char*[number_of_commands + 1]();
+    for(size_t i = 0; source != NULL && i < source->Labels(); ++i)
+    {
+        size_t address = source->LabelAddress(i);
+        if(address <= number_of_commands && label_at[address] == NULL)
+            label_at[address] = source->LabelName(i);
+    }
+
+    region = new size_t[number_of_commands + 1]();
+    region_names = new const char*[number_of_commands + 1]();
+    cycles = new uint64_t[number_of_commands + 1]();
+    number_of_regions = 1;
+    for(size_t i = 0; i < number_of_commands; ++i)
+    {
+        const char* label = LabelAt(i);
+        if(label != NULL && i != 0)
+            ++number_of_regions;
+        if(label != NULL)
+            region_names[number_of_regions - 1] = label;
+        region[i] = number_of_regions - 1;
+    }
+    current_region = 0;
+    last_tick = ProfileTicks();
+}
+
+///@note Ticks of the last region are added
+void Profiler::Stop()
+{
+    uint64_t now = ProfileTicks();
+    cycles[current_region] += now - last_tick;
+    last_tick = now;
+}
+
+///@return Name of the first label before the command, NULL if there is no label
+const char* Profiler::LabelAt(size_t address)
+{
+    return (address <= number_of_commands) ? label_at[address] : NULL;
+}
+
+/// Mnemonic and operands, labels are shown by their names
+void Profiler::CommandText(size_t command, char* text, size_t size)
+{
+    const Instruction* cur = &instrs[command];
+    const char* name = CommandName(cur->cmd_code);
+    char target[64] = "";
+    if(IsJump(cur->cmd_code))
+    {
+        const char* label = LabelAt(cur->address);
+        if(label != NULL)
+            snprintf(target, sizeof(target), ":%s", label);
+        else
+            snprintf(target, sizeof(target), "@%d", cur->address);
+    }
+
+    switch(cur->cmd_code)
+    {
+        case PUSH:
+        case POP:
+        case TOP:
+        case INPUT:
+        case OUTPUT:
+            if(cur->arg_flag == REG)
+                snprintf(text, size, "%s %s", name, REG_NAMES[cur->reg]);
+            else
+                snprintf(text, size, "%s %g", name, cur->value);
+            break;
+        case MOV:
+            if(cur->arg_flag == REG)
+                snprintf(text, size, "%s %s, %s", name, REG_NAMES[cur->reg], REG_NAMES[cur->src]);
+            else
+                snprintf(text, size, "%s %s, %g", name, REG_NAMES[cur->reg], cur->value);
+            break;
+        case ADDI:
+        case SUBI:
+        case MULI:
+            snprintf(text, size, "%s %s, %s, %g", name, REG_NAMES[cur->reg], REG_NAMES[cur->src], cur->value);
+            break;
+        case CJE:
+        case CJNE:
+        case CJB:
+        case CJBE:
+        case CJA:
+        case CJAE:
+            if(cur->arg_flag == REG_REG)
+                snprintf(text, size, "%s %s, %s, %s", name, REG_NAMES[cur->reg], REG_NAMES[cur->src], target);
+            else if(cur->arg_flag == REG_NUM)
+                snprintf(text, size, "%s %s, %g, %s", name, REG_NAMES[cur->reg], cur->value, target);
+            else
+                snprintf(text, size, "%s %g, %s, %s", name, cur->value, REG_NAMES[cur->src], target);
+            break;
+        default:
+            if(IsJump(cur->cmd_code))
+                snprintf(text, size, "%s %s", name, target);
+            else
+                snprintf(text, size, "%s", name);
+    }
+}
+
+///@return Number of commands executed in the run
+uint64_t Profiler::Total() const
+{
+    uint64_t total = 0;
+    for(size_t i = 0; i < number_of_commands; ++i)
+        total += executed[i];
+    return total;
+}
+
+//-------------------------------------------------------------------
+//! Function "Print" writes the regions and the annotated listing
+//!
+//!@note Lines are shown as "-" if the program came from an object file.
+//!      Profiler with NULL stream only counts
+//-------------------------------------------------------------------
+void Profiler::Print()
+{
+    if(out == NULL)
+        return;
+
+    uint64_t total_commands = Total();
+    uint64_t total_cycles = 0;
+    for(size_t i = 0; i < number_of_regions; ++i)
+        total_cycles += cycles[i];
+
+    fprintf(out, "Profile: %llu commands, %llu cycles\n",
+            (unsigned long long)total_commands, (unsigned long long)total_cycles);
+    fprintf(out, "%-20s %16s %7s\n", "Region", "Cycles", "Share");
+    for(size_t i = 0; i < number_of_regions; ++i)
+    {
+        double share = (total_cycles != 0) ? 100.0 * cycles[i] / total_cycles : 0;
+        fprintf(out, "%-20s %16llu %6.1f%%\n", (region_names[i] != NULL) ? region_names[i] : "(start)",
+                (unsigned long long)cycles[i], share);
+    }
+
+    fprintf(out, "\n%6s  %-28s %12s %12s %12s\n", "Line", "Command", "Count", "Taken", "Not taken");
+    char text[128] = "";
+    for(size_t i = 0; i < number_of_commands; ++i)
+    {
+        const char* label = LabelAt(i);
+        if(label != NULL)
+            fprintf(out, "%s:\n", label);
+
+        size_t line = (source != NULL) ? source->Line(i) : 0;
+        char line_text[32] = "-";
+        if(line != 0)
+            snprintf(line_text, sizeof(line_text), "%zu", line);
+        CommandText(i, text, sizeof(text));
+        fprintf(out, "%6s  %-28s %12llu", line_text, text, (unsigned long long)executed[i]);
+        if(IsConditionalJump(instrs[i].cmd_code))
+            fprintf(out, " %12llu %12llu", (unsigned long long)taken[i], (unsigned long long)not_taken[i]);
+        fprintf(out, "\n");
+    }
+    fflush(out);
+}
+
+void Profiler::Drop()
+{
+    delete [] executed;
+    delete [] taken;
+    delete [] not_taken;
+    delete [] region;
+    delete [] region_names;
+    delete [] cycles;
+    delete [] label_at;
+    executed = NULL;
+    taken = NULL;
+    not_taken = NULL;
+    region = NULL;
+    region_names = NULL;
+    cycles = NULL;
+    label_at = NULL;
+    number_of_regions = 0;
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include"functions.h"
+
+/// Compiled program in memory: the same commands as in the object file,
+/// so it can be run without writing and reading the file.
+/// Programs from the compiler also know the source lines and labels,
+/// they are not written to the object file but may be kept in a debug file
+class Program
+{
+    private:
+        Instruction* instrs;
+        size_t number_of_instructions;
+        size_t begin;             /// First command after "BEGIN"
+
+        size_t* lines;            /// Source line of every command, NULL if unknown
+        size_t number_of_labels;
+        char** label_names;
+        size_t* label_addresses;  /// Command after every label
+
+        void DropDebugInfo();
+
+    public:
+        Program()
+        {
+            instrs = NULL;
+            number_of_instructions = 0;
+            begin = 0;
+            lines = NULL;
+            number_of_labels = 0;
+            label_names = NULL;
+            label_addresses = NULL;
+        }
+        void Assign(const Instruction* commands, size_t number, size_t first);
+        void SetDebugInfo(const size_t* command_lines, size_t labels_number,
+                          const char* const* names, const size_t* addresses);
+        const Instruction* Instructions() const { return instrs; }
+        size_t Size() const { return number_of_instructions; }
+        size_t Begin() const { return begin; }
+        /// 0, if the line is unknown
+        size_t Line(size_t command) const { return (lines != NULL) ? lines[command] : 0; }
+        size_t Labels() const { return number_of_labels; }
+        const char* LabelName(size_t label) const { return label_names[label]; }
+        size_t LabelAddress(size_t label) const { return label_addresses[label]; }
+        void Save(const char* out_file) const;
+        bool Load(const char* in_file);
+        void SaveDebugInfo(const char* out_file) const;
+        bool LoadDebugInfo(const char* in_file);
+        ~Program()
+        {
+            DropDebugInfo();
+            delete [] instrs;
+        }
+};
+
+//-------------------------------------------------------------------
+//! Function "ObjectError" checks the image of the object file
+//!
+//!@param [in] image Contents of the file
+//!@param [in] size Number of bytes
+//!
+//!@return Description of the error, NULL if the header is correct
+//!
+//!@note Commands themselves are checked by the processor
+//-------------------------------------------------------------------
+const char* ObjectError(const void* image, size_t size)
+{
+    assert(image != NULL || size == 0);
+
+    if(size < sizeof(ObjectHeader))
+        return "too short";
+    const ObjectHeader* header = (const ObjectHeader*)image;
+    if(header->magic != OBJECT_MAGIC || header->version != OBJECT_VERSION)
+        return "wrong format or version";
+    if(header->number_of_instructions > size / sizeof(Instruction)
+       || size != sizeof(ObjectHeader) + header->number_of_instructions * sizeof(Instruction))
+        return "wrong size";
+    if(Checksum(header + 1, header->number_of_instructions * sizeof(Instruction)) != header->checksum)
+        return "wrong checksum";
+    return NULL;
+}
+
+///@note Commands are copied, lines and labels of the old commands are dropped
+void Program::Assign(const Instruction* commands, size_t number, size_t first)
+{
+    assert(commands != NULL || number == 0);
+
+    DropDebugInfo();
+    delete [] instrs;
+    instrs = new Instruction[number + 1]();
+    memcpy(instrs, commands, number * sizeof(Instruction));
+    number_of_instructions = number;
+    begin = first;
+}
+
+//-------------------------------------------------------------------
+//! Function "SetDebugInfo" keeps the source positions of the commands
+//!
+//!@param [in] command_lines Line of every command
+//!@param [in] labels_number Number of labels
+//!@param [in] names Name of every label
+//!@param [in] addresses Command after every label
+//!
+//!@note Everything is copied, call it after Assign
+//-------------------------------------------------------------------
+void Program::SetDebugInfo(const size_t* command_lines, size_t labels_number,
+                           const char* const* names, const size_t* addresses)
+{
+    assert(command_lines != NULL || number_of_instructions == 0);
+    assert((names != NULL && addresses != NULL) || labels_number == 0);
+
+    DropDebugInfo();
+    lines = new size_t[number_of_instructions + 1]();
+    memcpy(lines, command_lines, number_of_instructions * sizeof(size_t));
+
+    number_of_labels = labels_number;
+    label_names = new char*[number_of_labels];
+    label_addresses = new size_t[number_of_labels];
+    for(size_t i = 0; i < number_of_labels; ++i)
+    {
+        label_names[i] = new char[strlen(names[i]) + 1];
+        strcpy(label_names[i], names[i]);
+        label_addresses[i] = addresses[i];
+    }
+}
+
+void Program::DropDebugInfo()
+{
+    for(size_t i = 0; i < number_of_labels; ++i)
+        delete [] label_names[i];
+    delete [] label_names;
+    delete [] label_addresses;
+    delete [] lines;
+    lines = NULL;
+    number_of_labels = 0;
+    label_names = NULL;
+    label_addresses = NULL;
+}
+
+//-------------------------------------------------------------------
+//! Function "Save" exports the program to the object file
+//!
+//!@param [in] out_file Name of the file
+//!
+//!@note The file is read by Processor::Load
+//-------------------------------------------------------------------
+void Program::Save(const char* out_file) const
+{
+    assert(out_file != NULL);
+
+    ObjectHeader header = {};
+    header.magic = OBJECT_MAGIC;
+    header.version = OBJECT_VERSION;
+    header.number_of_instructions = number_of_instructions;
+    header.begin = begin;
+    header.checksum = Checksum(instrs, number_of_instructions * sizeof(Instruction));
+
+    FILE * out = fopen(out_file, "wb");
+    if(out == NULL)
+    {
+        printf("Can't open %s\n", out_file);
+        exit(1);
+    }
+    fwrite(&header, sizeof(ObjectHeader), 1, out);
+    fwrite(instrs, sizeof(Instruction), number_of_instructions, out);
+    fclose(out);
+}
+
+///@return false, if there is no such file or it is not a correct object file
+bool Program::Load(const char* in_file)
+{
+    assert(in_file != NULL);
+
+    struct stat info;
+    if(stat(in_file, &info) != 0 || info.st_size == 0)
+        return false;
+
+    size_t size = 0;
+    const char* image = MapFile(in_file, &size);
+    bool correct = (ObjectError(image, size) == NULL);
+    if(correct)
+    {
+        const ObjectHeader* header = (const ObjectHeader*)image;
+        Assign((const Instruction*)(header + 1), header->number_of_instructions, header->begin);
+    }
+    munmap((void*)image, size);
+    return correct;
+}
+
+//-------------------------------------------------------------------
+//! Function "SaveDebugInfo" writes the lines and the labels to the debug file
+//!
+//!@param [in] out_file Name of the file
+//!
+//!@note Unknown lines are written as 0. The file is read by LoadDebugInfo
+//-------------------------------------------------------------------
+void Program::SaveDebugInfo(const char* out_file) const
+{
+    assert(out_file != NULL);
+
+    size_t size = number_of_instructions * sizeof(uint64_t);
+    for(size_t i = 0; i < number_of_labels; ++i)
+        size += 2 * sizeof(uint64_t) + strlen(label_names[i]);
+    char* payload = new char[size + 1];
+    char* pos = payload;
+    for(size_t i = 0; i < number_of_instructions; ++i)
+    {
+        uint64_t line = Line(i);
+        memcpy(pos, &line, sizeof(line));
+        pos += sizeof(line);
+    }
+    for(size_t i = 0; i < number_of_labels; ++i)
+    {
+        uint64_t address = label_addresses[i];
+        uint64_t len = strlen(label_names[i]);
+        memcpy(pos, &address, sizeof(address));
+        memcpy(pos + sizeof(address), &len, sizeof(len));
+        memcpy(pos + 2 * sizeof(uint64_t), label_names[i], len);
+        pos += 2 * sizeof(uint64_t) + len;
+    }
+
+    DebugHeader header = {};
+    header.magic = DEBUG_MAGIC;
+    header.version = DEBUG_VERSION;
+    header.number_of_instructions = number_of_instructions;
+    header.number_of_labels = number_of_labels;
+    header.checksum = Checksum(payload, size);
+
+    FILE * out = fopen(out_file, "wb");
+    if(out == NULL)
+    {
+        printf("Can't open %s\n", out_file);
+        exit(1);
+    }
+    fwrite(&header, sizeof(DebugHeader), 1, out);
+    fwrite(payload, 1, size, out);
+    fclose(out);
+    delete [] payload;
+}
+
+//-------------------------------------------------------------------
+//! Function "LoadDebugInfo" reads the lines and the labels of the loaded program
+//!
+//!@param [in] in_file Name of the debug file
+//!
+//!@return false, if there is no such file or it doesn't fit the commands
+//!
+//!@note Call it after Assign or Load, the debug info is kept only if the file is correct
+//-------------------------------------------------------------------
+bool Program::LoadDebugInfo(const char* in_file)
+{
+    assert(in_file != NULL);
+
+    struct stat info;
+    if(stat(in_file, &info) != 0 || (size_t)info.st_size < sizeof(DebugHeader))
+        return false;
+
+    size_t size = 0;
+    const char* image = MapFile(in_file, &size);
+    const DebugHeader* header = (const DebugHeader*)image;
+    const char* pos = image + sizeof(DebugHeader);
+    size_t left = size - sizeof(DebugHeader);
+    if(size < sizeof(DebugHeader) || header->magic != DEBUG_MAGIC || header->version != DEBUG_VERSION
+       || header->number_of_instructions != number_of_instructions
+       || left / sizeof(uint64_t) < number_of_instructions
+       || Checksum(pos, left) != header->checksum)
+    {
+        munmap((void*)image, size);
+        return false;
+    }
+
+    size_t* command_lines = new size_t[number_of_instructions + 1]();
+    for(size_t i = 0; i < number_of_instructions; ++i)
+    {
+        uint64_t line = 0;
+        memcpy(&line, pos, sizeof(line));
+        command_lines[i] = line;
+        pos += sizeof(line);
+        left -= sizeof(line);
+    }
+
+    /// Every label is checked against the rest of the file
+    size_t labels_number = header->number_of_labels;
+    bool correct = (labels_number <= left / (2 * sizeof(uint64_t)));
+    if(!correct)
+        labels_number = 0;
+    char** names = new char*[labels_number + 1];
+    size_t* addresses = new size_t[labels_number + 1];
+    size_t number_read = 0;
+    while(correct && number_read < labels_number)
+    {
+        uint64_t address = 0;
+        uint64_t len = 0;
+        memcpy(&address, pos, sizeof(address));
+        memcpy(&len, pos + sizeof(address), sizeof(len));
+        pos += 2 * sizeof(uint64_t);
+        left -= 2 * sizeof(uint64_t);
+        correct = (len <= left && address <= number_of_instructions);
+        if(!correct)
+            break;
+        names[number_read] = new char[len + 1];
+        memcpy(names[number_read], pos, len);
+        names[number_read][len] = '\0';
+        addresses[number_read++] = address;
+        pos += len;
+        left -= len;
+    }
+    correct = correct && left == 0;
+
+    if(correct)
+        SetDebugInfo(command_lines, labels_number, names, addresses);
+    for(size_t i = 0; i < number_read; ++i)
+        delete [] names[i];
+    delete [] names;
+    delete [] addresses;
+    delete [] command_lines;
+    munmap((void*)image, size);
+    return correct;
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include<atomic>
+#include<pthread.h>
+#include<time.h>
+#include"processor.h"
+
+/// Deque of run indices (Chase-Lev).
+/// The owner takes runs from the bottom, other workers steal from the top.
+/// All runs are given before the start, so the array never grows
+class WorkDeque
+{
+    private:
+        size_t* tasks;
+        std::atomic<long> top;
+        std::atomic<long> bottom;
+
+    public:
+        WorkDeque()
+        {
+            tasks = NULL;
+            top = 0;
+            bottom = 0;
+        }
+        void Fill(size_t first, size_t number);
+        bool Take(size_t* task);
+        bool Steal(size_t* task);
+        ~WorkDeque()
+        {
+            delete [] tasks;
+        }
+};
+
+///@note Runs [first, first + number), must not be called while workers run
+void WorkDeque::Fill(size_t first, size_t number)
+{
+    delete [] tasks;
+    tasks = new size_t[number + 1];
+    for(size_t i = 0; i < number; ++i)
+        tasks[i] = first + i;
+    top.store(0);
+    bottom.store(number);
+}
+
+///@return false, if the deque is empty
+bool WorkDeque::Take(size_t* task)
+{
+    assert(task != NULL);
+
+    long b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long t = top.load(std::memory_order_relaxed);
+    if(t > b)
+    {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    *task = tasks[b];
+    if(t == b)
+    {
+        /// The last run: the owner races with the thieves
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+///@return false, if the deque is empty
+bool WorkDeque::Steal(size_t* task)
+{
+    assert(task != NULL);
+
+    while(true)
+    {
+        long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom.load(std::memory_order_acquire);
+        if(t >= b)
+            return false;
+
+        size_t stolen = tasks[t];
+        if(top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            *task = stolen;
+            return true;
+        }
+    }
+}
+
+struct WorkerStats
+{
+    size_t runs;      /// Runs done by the worker
+    size_t stolen;    /// Runs taken from the other workers
+    double seconds;   /// Time from the start to the last run
+};
+
+/// Runs one program over many inputs on all cores.
+/// Every worker has its own Processor, runs are balanced by stealing,
+/// so long and short runs may be mixed in any order
+class Runner
+{
+    private:
+        struct Worker
+        {
+            Runner* owner;
+            size_t index;
+            Processor processor;
+            SpanChannel channel;
+            WorkDeque deque;
+            WorkerStats stats;
+            pthread_t thread;
+        };
+
+        Worker* workers;
+        size_t number_of_workers;
+        Engine engine;
+        BatchLanes* runs;
+
+        void Start(Engine run_engine, size_t workers_number);
+        static void* WorkerMain(void* arg);
+        void Work(Worker* self);
+        void Execute(Worker* self, size_t run);
+
+    public:
+        Runner(const char* in_file, Engine run_engine = SWITCH_ENGINE, size_t workers_number = 0);
+        Runner(const Program* program, Engine run_engine = SWITCH_ENGINE, size_t workers_number = 0);
+        void Run(BatchLanes* all_runs);
+        size_t Workers() { return number_of_workers; }
+        const WorkerStats* Stats(size_t worker) { return &workers[worker].stats; }
+        void PrintStats();
+        ~Runner()
+        {
+            delete [] workers;
+        }
+};
+
+//-------------------------------------------------------------------
+//! Constructor loads the program into every worker
+//!
+//!@param [in] in_file Name of the object file (or the program in memory)
+//!@param [in] run_engine Engine of every run
+//!@param [in] workers_number Number of threads, 0 for all cores
+//!
+//-------------------------------------------------------------------
+Runner::Runner(const char* in_file, Engine run_engine, size_t workers_number)
+{
+    assert(in_file != NULL);
+
+    Start(run_engine, workers_number);
+    for(size_t i = 0; i < number_of_workers; ++i)
+        workers[i].processor.Load(in_file);
+}
+
+///@note Workers share the commands of the program, it must live while the runner works
+Runner::Runner(const Program* program, Engine run_engine, size_t workers_number)
+{
+    assert(program != NULL);
+
+    Start(run_engine, workers_number);
+    for(size_t i = 0; i < number_of_workers; ++i)
+        workers[i].processor.Load(program);
+}
+
+void Runner::Start(Engine run_engine, size_t workers_number)
+{
+    if(workers_number == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers_number = (cores > 0) ? cores : 1;
+    }
+    number_of_workers = workers_number;
+    engine = run_engine;
+    runs = NULL;
+    workers = new Worker[number_of_workers];
+    for(size_t i = 0; i < number_of_workers; ++i)
+    {
+        workers[i].owner = this;
+        workers[i].index = i;
+        workers[i].processor.SetChannel(&workers[i].channel);
+        workers[i].stats = WorkerStats();
+    }
+}
+
+//-------------------------------------------------------------------
+//! Function "Run" runs the program once for every lane
+//!
+//!@param [in, out] all_runs Inputs and results of the runs, see batch.h
+//!
+//!@note Results are kept in the order of the inputs.
+//!      Errors of the program stop the whole process as in Processor::Run
+//-------------------------------------------------------------------
+void Runner::Run(BatchLanes* all_runs)
+{
+    assert(all_runs != NULL);
+
+    runs = all_runs;
+    for(size_t i = 0; i < number_of_workers; ++i)
+    {
+        size_t first = runs->number * i / number_of_workers;
+        size_t last = runs->number * (i + 1) / number_of_workers;
+        workers[i].deque.Fill(first, last - first);
+        workers[i].stats = WorkerStats();
+    }
+
+    for(size_t i = 1; i < number_of_workers; ++i)
+        if(pthread_create(&workers[i].thread, NULL, WorkerMain, &workers[i]) != 0)
+        {
+            printf("Can't start worker %zu\n", i);
+            exit(1);
+        }
+    Work(&workers[0]);
+    for(size_t i = 1; i < number_of_workers; ++i)
+        pthread_join(workers[i].thread, NULL);
+}
+
+void* Runner::WorkerMain(void* arg)
+{
+    Worker* self = (Worker*)arg;
+    self->owner->Work(self);
+    return NULL;
+}
+
+void Runner::Work(Worker* self)
+{
+    timespec start = {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t run = 0;
+    while(true)
+    {
+        if(!self->deque.Take(&run))
+        {
+            /// Own runs are over: stealing from the next workers
+            bool found = false;
+            for(size_t i = 1; i < number_of_workers && !found; ++i)
+                found = workers[(self->index + i) % number_of_workers].deque.Steal(&run);
+            if(!found)
+                break;
+            ++self->stats.stolen;
+        }
+        Execute(self, run);
+        ++self->stats.runs;
+    }
+
+    timespec finish = {};
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    self->stats.seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+void Runner::Execute(Worker* self, size_t run)
+{
+    self->channel.Set(runs->inputs + run * runs->inputs_per_lane, runs->inputs_per_lane,
+                      runs->outputs + run * runs->outputs_per_lane, runs->outputs_per_lane);
+    self->processor.Execute(engine);
+    runs->output_counts[run] = self->channel.Written();
+    runs->errors[run] = LANE_OK;
+}
+
+void Runner::PrintStats()
+{
+    for(size_t i = 0; i < number_of_workers; ++i)
+    {
+        const WorkerStats* stats = &workers[i].stats;
+        double speed = (stats->seconds > 0) ? stats->runs / stats->seconds : 0;
+        printf("Worker %zu: %zu runs (%zu stolen), %.0f runs/s\n", i, stats->runs, stats->stolen, speed);
+    }
+}
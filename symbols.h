@@ -0,0 +1,152 @@
+#pragma once
+
+#include"functions.h"
+
+/// Table of label names.
+/// Every name is stored once in upper case (labels are case insensitive)
+/// and found by hash, so there is no limit for the length of names
+class SymbolTable
+{
+    private:
+        char* names;            /// All names, each ends with '\0'
+        size_t names_size;
+        size_t names_capacity;
+
+        size_t* offsets;        /// Start of every name in "names"
+        size_t number_of_symbols;
+        size_t symbols_capacity;
+
+        size_t* slots;          /// Index of symbol + 1, 0 for empty slot
+        size_t number_of_slots; /// Power of 2
+
+        uint64_t Hash(const char* data, size_t len);
+        bool Equal(size_t index, const char* data, size_t len);
+        size_t Slot(const char* data, size_t len);
+        void Grow();
+
+    public:
+        SymbolTable()
+        {
+            names = NULL;
+            names_size = 0;
+            names_capacity = 0;
+            offsets = NULL;
+            number_of_symbols = 0;
+            symbols_capacity = 0;
+            number_of_slots = 16;
+            slots = new size_t[number_of_slots]();
+        }
+        size_t Intern(const char* data, size_t len);
+        size_t Find(const char* data, size_t len);
+        void Clear();
+        const char* Name(size_t index) { return names + offsets[index]; }
+        size_t Size() { return number_of_symbols; }
+        ~SymbolTable()
+        {
+            delete [] names;
+            delete [] offsets;
+            delete [] slots;
+        }
+};
+
+uint64_t SymbolTable::Hash(const char* data, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; ++i)
+    {
+        hash ^= (unsigned char)toupper((unsigned char)data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool SymbolTable::Equal(size_t index, const char* data, size_t len)
+{
+    const char* name = Name(index);
+    for(size_t i = 0; i < len; ++i)
+        if((unsigned char)name[i] != toupper((unsigned char)data[i]))
+            return false;
+    return name[len] == '\0';
+}
+
+///@return slot of the name or the empty slot for it
+size_t SymbolTable::Slot(const char* data, size_t len)
+{
+    size_t mask = number_of_slots - 1;
+    size_t slot = Hash(data, len) & mask;
+    while(slots[slot] != 0 && !Equal(slots[slot] - 1, data, len))
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+/// Doubles the number of slots, table is kept at most half full
+void SymbolTable::Grow()
+{
+    size_t* old_slots = slots;
+    size_t old_number = number_of_slots;
+    number_of_slots *= 2;
+    slots = new size_t[number_of_slots]();
+    for(size_t i = 0; i < old_number; ++i)
+        if(old_slots[i] != 0)
+        {
+            const char* name = Name(old_slots[i] - 1);
+            slots[Slot(name, strlen(name))] = old_slots[i];
+        }
+    delete [] old_slots;
+}
+
+///@return index of the name, the name is added if it is new
+size_t SymbolTable::Intern(const char* data, size_t len)
+{
+    assert(data != NULL);
+
+    size_t slot = Slot(data, len);
+    if(slots[slot] != 0)
+        return slots[slot] - 1;
+
+    if(names_size + len + 1 > names_capacity)
+    {
+        names_capacity = 2 * (names_capacity + len + 1);
+        char* new_names = new char[names_capacity];
+        memcpy(new_names, names, names_size);
+        delete [] names;
+        names = new_names;
+    }
+    if(number_of_symbols == symbols_capacity)
+    {
+        symbols_capacity = 2 * symbols_capacity + 16;
+        size_t* new_offsets = new size_t[symbols_capacity];
+        memcpy(new_offsets, offsets, number_of_symbols * sizeof(size_t));
+        delete [] offsets;
+        offsets = new_offsets;
+    }
+
+    offsets[number_of_symbols] = names_size;
+    for(size_t i = 0; i < len; ++i)
+        names[names_size++] = toupper((unsigned char)data[i]);
+    names[names_size++] = '\0';
+    slots[slot] = ++number_of_symbols;
+
+    if(2 * number_of_symbols > number_of_slots)
+        Grow();
+    return number_of_symbols - 1;
+}
+
+///@note Memory is kept for the next names
+void SymbolTable::Clear()
+{
+    names_size = 0;
+    number_of_symbols = 0;
+    memset(slots, 0, number_of_slots * sizeof(size_t));
+}
+
+///@return index of the name, NOT_FOUND if there is no such name
+size_t SymbolTable::Find(const char* data, size_t len)
+{
+    assert(data != NULL);
+
+    size_t slot = Slot(data, len);
+    if(slots[slot] == 0)
+        return (size_t)NOT_FOUND;
+    return slots[slot] - 1;
+}
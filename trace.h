@@ -0,0 +1,583 @@
+#pragma once
+
+#include<atomic>
+#include<pthread.h>
+#include<sched.h>
+#include<time.h>
+#include"functions.h"
+
+/// Size of the ring of TraceRecorder in words
+const size_t TRACE_RING_SIZE = 1 << 16;
+/// Conditional jumps between two checkpoints.
+/// Every loop has one, so the checkpoints are not counted by commands:
+/// this would cost a counter on every dispatch
+const uint64_t TRACE_PERIOD = 1 << 16;
+
+/// Records of the trace: header word (type in the high byte, value in the rest)
+/// followed by the data words
+enum TraceRecord
+{
+    TRACE_RUN = 1,         /// value: number of commands; checksum of the commands, period, ValueKind
+    TRACE_INPUT = 2,       /// bits of the number
+    TRACE_BRANCHES = 3,    /// value: number of outcomes; outcomes, the first one in bit 0
+    TRACE_CHECKPOINT = 4,  /// value: stack size; branches before it, IP, flags, registers, stack from the bottom
+    TRACE_END = 5,         /// value: number of branches
+    TRACE_ERROR = 6,       /// value: number of branches, the run was stopped by an error of the VM
+};
+
+const int TRACE_TYPE_SHIFT = 56;
+const uint64_t TRACE_VALUE_MASK = (1ULL << TRACE_TYPE_SHIFT) - 1;
+
+uint64_t TraceWord(double value)
+{
+    uint64_t word = 0;
+    memcpy(&word, &value, sizeof(word));
+    return word;
+}
+
+double TraceNumber(uint64_t word)
+{
+    double value = 0;
+    memcpy(&value, &word, sizeof(value));
+    return value;
+}
+
+/// Ring of words with one writer and one reader, no locks.
+/// The writer waits only if the reader is a whole ring behind
+class TraceRing
+{
+    private:
+        uint64_t* words;
+        size_t mask;
+        std::atomic<size_t> head;   /// Next word to write
+        std::atomic<size_t> tail;   /// Next word to read
+        size_t known_tail;          /// Tail seen by the writer
+
+    public:
+        ///@note size must be a power of 2
+        TraceRing(size_t size = TRACE_RING_SIZE)
+        {
+            assert(size != 0 && (size & (size - 1)) == 0);
+            words = new uint64_t[size];
+            mask = size - 1;
+            head = 0;
+            tail = 0;
+            known_tail = 0;
+        }
+        void Put(uint64_t word)
+        {
+            size_t pos = head.load(std::memory_order_relaxed);
+            while(pos - known_tail > mask)
+            {
+                known_tail = tail.load(std::memory_order_acquire);
+                if(pos - known_tail > mask)
+                    sched_yield();
+            }
+            words[pos & mask] = word;
+            head.store(pos + 1, std::memory_order_release);
+        }
+        size_t Get(uint64_t* dst, size_t max_number);
+        void Clear()
+        {
+            head = 0;
+            tail = 0;
+            known_tail = 0;
+        }
+        ~TraceRing()
+        {
+            delete [] words;
+        }
+};
+
+///@return Number of words moved to dst
+size_t TraceRing::Get(uint64_t* dst, size_t max_number)
+{
+    assert(dst != NULL);
+
+    size_t first = tail.load(std::memory_order_relaxed);
+    size_t last = head.load(std::memory_order_acquire);
+    size_t number = last - first;
+    if(number > max_number)
+        number = max_number;
+    for(size_t i = 0; i < number; ++i)
+        dst[i] = words[(first + i) & mask];
+    tail.store(first + number, std::memory_order_release);
+    return number;
+}
+
+class TraceRecorder;
+
+/// Recorder of the run on this thread, the errors of the VM exit without Stop
+thread_local TraceRecorder* active_recorder = NULL;
+void TraceAtExit();
+
+/// Writes the log of one run: the processor puts the records into the ring,
+/// the thread of the recorder moves them to the file
+class TraceRecorder
+{
+    private:
+        char* file_name;
+        int fd;
+        TraceRing ring;
+        pthread_t writer;
+        std::atomic<bool> finished;
+
+        uint64_t branches;          /// Outcomes not written yet
+        int number_of_branches;
+        uint64_t countdown;         /// Branches before the next checkpoint
+        uint64_t period;
+        uint64_t steps;             /// Branches before the last checkpoint
+
+        static void* WriterMain(void* arg);
+        void FlushBranches();
+        void Finish(int record);
+
+    public:
+        TraceRecorder(const char* out_file, uint64_t checkpoint_period = TRACE_PERIOD)
+        {
+            assert(out_file != NULL);
+            assert(checkpoint_period != 0);
+
+            file_name = new char[strlen(out_file) + 1];
+            strcpy(file_name, out_file);
+            fd = -1;
+            finished = false;
+            branches = 0;
+            number_of_branches = 0;
+            period = checkpoint_period;
+            countdown = period;
+            steps = 0;
+        }
+        void Start(const Instruction* commands, size_t number, int kind);
+        void Stop();
+        void Fail();
+        void Input(double value);
+        template<class T>
+        void Checkpoint(size_t ip, const T* regs, bool zero, bool above,
+                        const T* stack, size_t stack_size);
+
+        ///@return true, if it is time for the checkpoint
+        bool Branch(bool taken)
+        {
+            branches |= (uint64_t)taken << number_of_branches;
+            if(++number_of_branches == 64)
+                FlushBranches();
+            if(--countdown != 0)
+                return false;
+            countdown = period;
+            steps += period;
+            return true;
+        }
+        ~TraceRecorder()
+        {
+            delete [] file_name;
+        }
+};
+
+//-------------------------------------------------------------------
+//! Function "Start" opens the log and starts the writer thread
+//!
+//!@param [in] commands Commands of the program, the replay checks them
+//!@param [in] number Number of commands
+//!@param [in] kind ValueKind of the processor, numbers are stored as they are
+//!
+//!@note The log of the previous run is overwritten
+//-------------------------------------------------------------------
+void TraceRecorder::Start(const Instruction* commands, size_t number, int kind)
+{
+    assert(commands != NULL || number == 0);
+
+    fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        printf("Can't open %s\n", file_name);
+        exit(1);
+    }
+    ring.Clear();
+    finished = false;
+    branches = 0;
+    number_of_branches = 0;
+    countdown = period;
+    steps = 0;
+    if(pthread_create(&writer, NULL, WriterMain, this) != 0)
+    {
+        printf("Can't start the trace writer\n");
+        exit(1);
+    }
+    static const int hook = atexit(TraceAtExit);
+    (void)hook;
+    active_recorder = this;
+
+    ring.Put(((uint64_t)TRACE_RUN << TRACE_TYPE_SHIFT) | number);
+    ring.Put(Checksum(commands, number * sizeof(Instruction)));
+    ring.Put(period);
+    ring.Put(kind);
+}
+
+///@note The log is complete after it
+void TraceRecorder::Stop()
+{
+    Finish(TRACE_END);
+}
+
+///@note Ends the log of the run stopped by an error, the ring is written out.
+///      Nothing is done on the writer thread itself, it can't wait for itself
+void TraceRecorder::Fail()
+{
+    if(pthread_equal(pthread_self(), writer))
+        return;
+    Finish(TRACE_ERROR);
+}
+
+void TraceRecorder::Finish(int record)
+{
+    active_recorder = NULL;
+    FlushBranches();
+    ring.Put(((uint64_t)record << TRACE_TYPE_SHIFT) | (steps + period - countdown));
+    finished.store(true, std::memory_order_release);
+    pthread_join(writer, NULL);
+    close(fd);
+    fd = -1;
+}
+
+/// Registered by the first TraceRecorder::Start
+void TraceAtExit()
+{
+    if(active_recorder != NULL)
+        active_recorder->Fail();
+}
+
+void* TraceRecorder::WriterMain(void* arg)
+{
+    TraceRecorder* self = (TraceRecorder*)arg;
+    uint64_t buffer[1024];
+    while(true)
+    {
+        /// Words put before "finished" are seen after it
+        bool last = self->finished.load(std::memory_order_acquire);
+        size_t number = self->ring.Get(buffer, sizeof(buffer) / sizeof(buffer[0]));
+        if(number == 0)
+        {
+            if(last)
+                break;
+            timespec pause = {0, 100000};
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        const char* bytes = (const char*)buffer;
+        size_t size = number * sizeof(uint64_t);
+        for(size_t done = 0; done < size; )
+        {
+            ssize_t res = write(self->fd, bytes + done, size - done);
+            if(res <= 0)
+            {
+                printf("Can't write %s\n", self->file_name);
+                exit(1);
+            }
+            done += res;
+        }
+    }
+    return NULL;
+}
+
+void TraceRecorder::FlushBranches()
+{
+    if(number_of_branches == 0)
+        return;
+    ring.Put(((uint64_t)TRACE_BRANCHES << TRACE_TYPE_SHIFT) | number_of_branches);
+    ring.Put(branches);
+    branches = 0;
+    number_of_branches = 0;
+}
+
+void TraceRecorder::Input(double value)
+{
+    ring.Put((uint64_t)TRACE_INPUT << TRACE_TYPE_SHIFT);
+    ring.Put(TraceWord(value));
+}
+
+//-------------------------------------------------------------------
+//! Function "Checkpoint" saves the state before the command at ip
+//!
+//!@note Taken at the start and after the jumps, when Branch asks for it.
+//!      Outcomes of the branches before it are written first,
+//!      so the replay from the checkpoint starts from a whole record
+//-------------------------------------------------------------------
+template<class T>
+void TraceRecorder::Checkpoint(size_t ip, const T* regs, bool zero, bool above,
+                               const T* stack, size_t stack_size)
+{
+    static_assert(sizeof(T) == sizeof(uint64_t), "numbers must fit the words of the trace");
+    assert(regs != NULL);
+    assert(stack != NULL || stack_size == 0);
+
+    FlushBranches();
+    ring.Put(((uint64_t)TRACE_CHECKPOINT << TRACE_TYPE_SHIFT) | stack_size);
+    ring.Put(steps);
+    ring.Put(ip);
+    ring.Put((uint64_t)zero | ((uint64_t)above << 1));
+    uint64_t word = 0;
+    for(int i = 0; i < NUMBER_OF_REGS; ++i)
+    {
+        memcpy(&word, &regs[i], sizeof(word));
+        ring.Put(word);
+    }
+    for(size_t i = 0; i < stack_size; ++i)
+    {
+        memcpy(&word, &stack[i], sizeof(word));
+        ring.Put(word);
+    }
+}
+
+/// State of the processor saved in the log
+struct TraceCheckpoint
+{
+    uint64_t step;              /// Branches before it
+    size_t ip;
+    bool zero;
+    bool above;
+    uint64_t regs[NUMBER_OF_REGS];  /// Bytes of the numbers of the processor
+    const uint64_t* stack;      /// Stack in the log, from the bottom
+    size_t stack_size;
+    size_t input;               /// Numbers read before it
+    size_t branch;              /// Branches done before it
+};
+
+/// Recorded run for the replay: the processor reads the numbers from it
+/// and checks every branch and checkpoint against it
+class TraceLog
+{
+    private:
+        const uint64_t* words;      /// Mapped file
+        size_t number_of_words;
+        size_t number_of_commands;
+        uint64_t commands_checksum;
+        uint64_t period;
+        int kind;
+
+        double* inputs;
+        size_t number_of_inputs;
+        uint64_t* branches;         /// Outcome of branch i in bit i % 64 of word i / 64
+        size_t number_of_branches;
+        TraceCheckpoint* checkpoints;
+        size_t number_of_checkpoints;
+        bool failed;                /// The run was stopped by an error
+
+        size_t input_pos;           /// Position of the replay
+        size_t branch_pos;
+        size_t next_checkpoint;
+        uint64_t countdown;
+
+        const char* Parse();
+        void Drop();
+
+    public:
+        TraceLog()
+        {
+            words = NULL;
+            number_of_words = 0;
+            inputs = NULL;
+            branches = NULL;
+            checkpoints = NULL;
+            Drop();
+        }
+        void Load(const char* in_file);
+        bool Matches(const Instruction* commands, size_t number, int value_kind) const;
+        size_t Checkpoints() const { return number_of_checkpoints; }
+        /// The replay stops on the same error
+        bool Failed() const { return failed; }
+        const TraceCheckpoint* Seek(size_t checkpoint);
+
+        bool NextInput(double* value)
+        {
+            if(input_pos == number_of_inputs)
+                return false;
+            *value = inputs[input_pos++];
+            return true;
+        }
+
+        ///@return false, if the recorded run went the other way
+        bool SameBranch(bool taken)
+        {
+            if(branch_pos == number_of_branches)
+                return false;
+            bool recorded = (branches[branch_pos / 64] >> (branch_pos % 64)) & 1;
+            ++branch_pos;
+            return recorded == taken;
+        }
+
+        ///@return true, if it is time to check the next checkpoint,
+        ///        called after every branch as TraceRecorder::Branch
+        bool Tick()
+        {
+            if(--countdown != 0)
+                return false;
+            countdown = period;
+            return true;
+        }
+        bool Check(size_t ip, const void* regs, bool zero, bool above,
+                   const void* stack, size_t stack_size);
+
+        ~TraceLog()
+        {
+            Drop();
+        }
+};
+
+void TraceLog::Load(const char* in_file)
+{
+    assert(in_file != NULL);
+
+    Drop();
+    size_t size = 0;
+    words = (const uint64_t*)MapFile(in_file, &size);
+    number_of_words = size / sizeof(uint64_t);
+    const char* error = (size % sizeof(uint64_t) == 0) ? Parse() : "wrong size";
+    if(error != NULL)
+    {
+        printf("Trace file error: %s: %s\n", in_file, error);
+        exit(1);
+    }
+}
+
+///@return Description of the error, NULL if the log is correct
+const char* TraceLog::Parse()
+{
+    if(number_of_words < 4 || (words[0] >> TRACE_TYPE_SHIFT) != TRACE_RUN || words[2] == 0)
+        return "not a trace";
+    number_of_commands = words[0] & TRACE_VALUE_MASK;
+    commands_checksum = words[1];
+    period = words[2];
+    kind = words[3];
+
+    /// Every record takes at least two words
+    inputs = new double[number_of_words / 2 + 1];
+    branches = new uint64_t[number_of_words / 2 + 1]();
+    checkpoints = new TraceCheckpoint[number_of_words / 2 + 1];
+
+    bool ended = false;
+    size_t pos = 4;
+    while(pos < number_of_words && !ended)
+    {
+        uint64_t value = words[pos] & TRACE_VALUE_MASK;
+        size_t rest = number_of_words - pos - 1;
+        switch(words[pos] >> TRACE_TYPE_SHIFT)
+        {
+            case TRACE_INPUT:
+                if(rest < 1)
+                    return "cut record";
+                inputs[number_of_inputs++] = TraceNumber(words[pos + 1]);
+                pos += 2;
+                break;
+            case TRACE_BRANCHES:
+                if(rest < 1 || value == 0 || value > 64)
+                    return "wrong branches";
+                for(uint64_t i = 0; i < value; ++i, ++number_of_branches)
+                    branches[number_of_branches / 64] |= ((words[pos + 1] >> i) & 1) << (number_of_branches % 64);
+                pos += 2;
+                break;
+            case TRACE_CHECKPOINT:
+            {
+                if(rest < 3 + NUMBER_OF_REGS || rest - 3 - NUMBER_OF_REGS < value)
+                    return "cut checkpoint";
+                TraceCheckpoint* state = &checkpoints[number_of_checkpoints++];
+                state->step = words[pos + 1];
+                state->ip = words[pos + 2];
+                state->zero = words[pos + 3] & 1;
+                state->above = (words[pos + 3] >> 1) & 1;
+                for(int i = 0; i < NUMBER_OF_REGS; ++i)
+                    state->regs[i] = words[pos + 4 + i];
+                state->stack = words + pos + 4 + NUMBER_OF_REGS;
+                state->stack_size = value;
+                state->input = number_of_inputs;
+                state->branch = number_of_branches;
+                pos += 4 + NUMBER_OF_REGS + value;
+                break;
+            }
+            case TRACE_END:
+            case TRACE_ERROR:
+                ended = true;
+                failed = ((words[pos] >> TRACE_TYPE_SHIFT) == TRACE_ERROR);
+                break;
+            default:
+                return "unknown record";
+        }
+    }
+    if(!ended)
+        return "no end of the run";
+    if(number_of_checkpoints == 0 || checkpoints[0].ip > number_of_commands)
+        return "no start of the run";
+    return NULL;
+}
+
+///@return true, if the log was written by these commands on the same numbers
+bool TraceLog::Matches(const Instruction* commands, size_t number, int value_kind) const
+{
+    return number == number_of_commands && value_kind == kind
+           && Checksum(commands, number * sizeof(Instruction)) == commands_checksum;
+}
+
+//-------------------------------------------------------------------
+//! Function "Seek" moves the replay to the checkpoint
+//!
+//!@param [in] checkpoint Index of the checkpoint, 0 is the start of the run
+//!
+//!@return State to restore before the replay
+//!
+//-------------------------------------------------------------------
+const TraceCheckpoint* TraceLog::Seek(size_t checkpoint)
+{
+    assert(checkpoint < number_of_checkpoints);
+
+    const TraceCheckpoint* state = &checkpoints[checkpoint];
+    input_pos = state->input;
+    branch_pos = state->branch;
+    next_checkpoint = checkpoint + 1;
+    countdown = period;
+    return state;
+}
+
+///@return false, if the state differs from the next checkpoint of the log
+///@note Registers and stack are compared by the bytes of the numbers
+bool TraceLog::Check(size_t ip, const void* regs, bool zero, bool above,
+                     const void* stack, size_t stack_size)
+{
+    assert(regs != NULL);
+    assert(stack != NULL || stack_size == 0);
+
+    if(next_checkpoint == number_of_checkpoints)
+        return true;
+
+    const TraceCheckpoint* state = &checkpoints[next_checkpoint++];
+    return state->ip == ip && state->zero == zero && state->above == above
+           && state->stack_size == stack_size
+           && memcmp(state->regs, regs, sizeof(state->regs)) == 0
+           && (stack_size == 0 || memcmp(state->stack, stack, stack_size * sizeof(uint64_t)) == 0);
+}
+
+void TraceLog::Drop()
+{
+    if(words != NULL)
+        munmap((void*)words, number_of_words * sizeof(uint64_t));
+    delete [] inputs;
+    delete [] branches;
+    delete [] checkpoints;
+    words = NULL;
+    number_of_words = 0;
+    number_of_commands = 0;
+    commands_checksum = 0;
+    period = TRACE_PERIOD;
+    kind = 0;
+    inputs = NULL;
+    number_of_inputs = 0;
+    branches = NULL;
+    number_of_branches = 0;
+    checkpoints = NULL;
+    number_of_checkpoints = 0;
+    failed = false;
+    input_pos = 0;
+    branch_pos = 0;
+    next_checkpoint = 0;
+    countdown = period;
+}
@@ -0,0 +1,445 @@
+#pragma once
+
+#include"functions.h"
+
+/// Commands of the register form.
+/// Every operand is an index in the frame of slots:
+/// [0, NUMBER_OF_REGS) - user registers,
+/// then one slot for every stack depth,
+/// then the constants of the program
+enum RegOp
+{
+    R_COPY = 0,   /// dst = a
+    R_ADD,        /// dst = a + b, flags
+    R_SUB,        /// dst = a - b, flags
+    R_MUL,        /// dst = a * b, flags
+    R_DIV,        /// dst = a / b, flags
+    R_MOD,        /// dst = a % b, flags
+    R_SQRT,       /// dst = sqrt(a), flags
+    R_ABS,        /// dst = abs(a), flags
+    R_CMP,        /// flags of (int)(a - b)
+    R_INPUT,      /// dst = number from the user
+    R_OUTPUT,     /// print a (user register)
+    R_JMP,
+    R_JE,
+    R_JNE,
+    R_JB,
+    R_JBE,
+    R_JA,
+    R_JAE,
+    R_CJE,        /// flags of (int)(a - b) and R_JE
+    R_CJNE,
+    R_CJB,
+    R_CJBE,
+    R_CJA,
+    R_CJAE,
+    R_BEGIN,      /// second BEGIN
+    R_END,
+    R_HALT,       /// jump past the last command
+    R_UNREACHABLE
+};
+
+struct RegInstr
+{
+    int op;        //RegOp
+    int dst;
+    int a;
+    int b;
+    size_t target; //index in the register form
+    size_t origin; //index of the original command
+    bool flags;    //the flags of the command are read later (see FLAGS_UNUSED)
+};
+
+//---------------------------------------------------------------
+//! Function "StackEffect" describes work of command with stack
+//!
+//!@param [in] code Command code
+//!
+//!@param [out] need Number of elements the command reads
+//!@param [out] delta Change of the stack depth
+//!
+//---------------------------------------------------------------
+void StackEffect(int code, int* need, int* delta)
+{
+    assert(need != NULL);
+    assert(delta != NULL);
+
+    *need = 0;
+    *delta = 0;
+    switch(code)
+    {
+        case PUSH:
+            *delta = 1;
+            break;
+        case POP:
+            *need = 1;
+            *delta = -1;
+            break;
+        case TOP:
+        case SQRT:
+        case ABS:
+            *need = 1;
+            break;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD:
+            *need = 2;
+            *delta = -1;
+            break;
+        case CMP:
+            *need = 2;
+            *delta = -2;
+            break;
+        default:
+            break;
+    }
+}
+
+//---------------------------------------------------------------
+//! Function "RegisterOperands" describes the registers of command
+//!
+//!@param [in] instr Command
+//!
+//!@param [out] reg The command uses the reg field as a register
+//!@param [out] src The command uses the src field as a register
+//!
+//!@return true, if the command is known
+//!        false, if not
+//---------------------------------------------------------------
+bool RegisterOperands(const Instruction* instr, bool* reg, bool* src)
+{
+    assert(instr != NULL);
+    assert(reg != NULL);
+    assert(src != NULL);
+
+    *reg = false;
+    *src = false;
+    switch(instr->cmd_code)
+    {
+        case PUSH:
+            *reg = (instr->arg_flag == REG);
+            return true;
+        case POP:
+        case TOP:
+        case INPUT:
+        case OUTPUT:
+            *reg = true;
+            return true;
+        case MOV:
+            *reg = true;
+            *src = (instr->arg_flag == REG);
+            return true;
+        case ADDI:
+        case SUBI:
+        case MULI:
+            *reg = true;
+            *src = true;
+            return true;
+        case CJE:
+        case CJNE:
+        case CJB:
+        case CJBE:
+        case CJA:
+        case CJAE:
+            *reg = (instr->arg_flag != NUM_REG);
+            *src = (instr->arg_flag != REG_NUM);
+            return true;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD:
+        case DUMP:
+        case JMP:
+        case BEGIN:
+        case END:
+        case SQRT:
+        case ABS:
+        case CMP:
+        case JE:
+        case JNE:
+        case JB:
+        case JBE:
+        case JA:
+        case JAE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//---------------------------------------------------------------------
+//! Function "StackDepths" counts stack depth before every command
+//!
+//!@param [in] instrs Commands
+//!@param [in] num Number of commands
+//!@param [in] begin First command after BEGIN
+//!@param [in] limit Maximum stack depth
+//!
+//!@param [out] depth Array of num elements, -1 for unreachable commands
+//!@param [out] fault Command that goes out of [0, limit], if the depth is the same
+//!                   on all paths, num otherwise. May be NULL
+//!
+//!@return true, if depth of every reachable command is the same
+//!        on all paths and stays in [0, limit]
+//!        false, if not
+//!
+//!@note The commands after the fault are not counted, only the fault itself can't be run
+//---------------------------------------------------------------------
+bool StackDepths(const Instruction* instrs, size_t num, size_t begin, int* depth, size_t limit,
+                 size_t* fault = NULL)
+{
+    assert(instrs != NULL);
+    assert(depth != NULL);
+
+    for(size_t i = 0; i < num; ++i)
+        depth[i] = -1;
+    if(begin >= num)
+        return true;
+
+    size_t* work = new size_t[num];
+    size_t work_size = 0;
+    depth[begin] = 0;
+    work[work_size++] = begin;
+
+    bool correct = true;
+    size_t first_fault = num;
+    while(work_size > 0 && correct)
+    {
+        size_t i = work[--work_size];
+        int cur = depth[i];
+        size_t next[2] = {i + 1, num};
+        size_t number_of_next = 1;
+
+        int need = 0;
+        int delta = 0;
+        StackEffect(instrs[i].cmd_code, &need, &delta);
+        if(cur < need || cur + delta > (int)limit)
+        {
+            if(first_fault == num)
+                first_fault = i;
+            continue;
+        }
+        cur += delta;
+
+        int code = instrs[i].cmd_code;
+        if(code == END || code == BEGIN)
+            number_of_next = 0;
+        else if(IsJump(code))
+        {
+            next[0] = instrs[i].address;
+            if(code != JMP)
+            {
+                next[1] = i + 1;
+                number_of_next = 2;
+            }
+        }
+
+        for(size_t j = 0; j < number_of_next; ++j)
+        {
+            if(next[j] >= num)
+                continue;
+            if(depth[next[j]] == -1)
+            {
+                depth[next[j]] = cur;
+                work[work_size++] = next[j];
+            }
+            else if(depth[next[j]] != cur)
+                correct = false;
+        }
+    }
+    delete [] work;
+    if(fault != NULL)
+        *fault = correct ? first_fault : num;
+    return correct && first_fault == num;
+}
+
+class Translator
+{
+    private:
+        size_t consts_start;
+        size_t number_of_consts;
+        int AddConst(double value);
+        int Slot(int depth) { return NUMBER_OF_REGS + depth; }
+
+    public:
+        RegInstr* code;
+        size_t number_of_codes;
+        size_t entry;           /// First command in the register form
+        double* frame;          /// Initial frame: zero registers and stack, constants
+        size_t frame_size;
+
+        Translator()
+        {
+            consts_start = 0;
+            number_of_consts = 0;
+            code = NULL;
+            number_of_codes = 0;
+            entry = 0;
+            frame = NULL;
+            frame_size = 0;
+        }
+        bool Translate(const Instruction* instrs, size_t num, size_t begin, size_t limit);
+        ~Translator()
+        {
+            delete [] code;
+            delete [] frame;
+        }
+};
+
+int Translator::AddConst(double value)
+{
+    for(size_t i = consts_start; i < consts_start + number_of_consts; ++i)
+        if(frame[i] == value)
+            return i;
+    frame[consts_start + number_of_consts] = value;
+    return consts_start + number_of_consts++;
+}
+
+///@return false, if stack depth is not static and program must be interpreted
+bool Translator::Translate(const Instruction* instrs, size_t num, size_t begin, size_t limit)
+{
+    assert(instrs != NULL);
+
+    int* depth = new int[num + 1];
+    if(!StackDepths(instrs, num, begin, depth, limit))
+    {
+        delete [] depth;
+        return false;
+    }
+
+    /// The stack content is printed by DUMP only with the real stack
+    int max_depth = 0;
+    for(size_t i = 0; i < num; ++i)
+    {
+        if(depth[i] == -1)
+            continue;
+        if(instrs[i].cmd_code == DUMP)
+        {
+            delete [] depth;
+            return false;
+        }
+        if(depth[i] + 1 > max_depth)
+            max_depth = depth[i] + 1;
+    }
+
+    /// Every command keeps its index in the register form
+    number_of_codes = num;
+    entry = begin;
+
+    /// Every command has at most 1 constant
+    consts_start = NUMBER_OF_REGS + max_depth;
+    frame_size = consts_start + num;
+    frame = new double[frame_size]();
+    code = new RegInstr[number_of_codes + 1]();
+    number_of_consts = 0;
+
+    for(size_t i = 0; i < num; ++i)
+    {
+        const Instruction* instr = &instrs[i];
+        RegInstr* res = &code[i];
+        res->origin = i;
+        if(depth[i] == -1)
+        {
+            res->op = R_UNREACHABLE;
+            continue;
+        }
+        int top = Slot(depth[i] - 1);
+        switch(instr->cmd_code)
+        {
+            case PUSH:
+                res->op = R_COPY;
+                res->dst = Slot(depth[i]);
+                res->a = (instr->arg_flag == REG) ? instr->reg : AddConst(instr->value);
+                break;
+            case POP:
+            case TOP:
+                res->op = R_COPY;
+                res->dst = instr->reg;
+                res->a = top;
+                break;
+            case ADD:
+            case SUB:
+            case MUL:
+            case DIV:
+            case MOD:
+                res->op = R_ADD + (instr->cmd_code - ADD);
+                res->dst = top - 1;
+                res->a = top - 1;
+                res->b = top;
+                break;
+            case CMP:
+                res->op = R_CMP;
+                res->a = top - 1;
+                res->b = top;
+                break;
+            case SQRT:
+            case ABS:
+                res->op = (instr->cmd_code == SQRT) ? R_SQRT : R_ABS;
+                res->dst = top;
+                res->a = top;
+                break;
+            case INPUT:
+                res->op = R_INPUT;
+                res->dst = instr->reg;
+                break;
+            case OUTPUT:
+                res->op = R_OUTPUT;
+                res->a = instr->reg;
+                break;
+            case MOV:
+                res->op = R_COPY;
+                res->dst = instr->reg;
+                res->a = (instr->arg_flag == REG) ? instr->src : AddConst(instr->value);
+                break;
+            case ADDI:
+            case SUBI:
+            case MULI:
+                res->op = R_ADD + (instr->cmd_code - ADDI);
+                res->dst = instr->reg;
+                res->a = instr->src;
+                res->b = AddConst(instr->value);
+                break;
+            case JMP:
+                res->op = R_JMP;
+                res->target = instr->address;
+                break;
+            case JE:
+            case JNE:
+            case JB:
+            case JBE:
+            case JA:
+            case JAE:
+                res->op = R_JE + (instr->cmd_code - JE);
+                res->target = instr->address;
+                break;
+            case CJE:
+            case CJNE:
+            case CJB:
+            case CJBE:
+            case CJA:
+            case CJAE:
+                res->op = R_CJE + (instr->cmd_code - CJE);
+                res->a = (instr->arg_flag == NUM_REG) ? AddConst(instr->value) : instr->reg;
+                res->b = (instr->arg_flag == REG_NUM) ? AddConst(instr->value) : instr->src;
+                res->target = instr->address;
+                break;
+            case BEGIN:
+                res->op = R_BEGIN;
+                break;
+            case END:
+                res->op = R_END;
+                break;
+            default:
+                res->op = R_UNREACHABLE;
+        }
+        res->flags = SetsFlags(instr->cmd_code) && instr->address != FLAGS_UNUSED;
+    }
+    code[number_of_codes].op = R_HALT;
+    code[number_of_codes].origin = num;
+
+    delete [] depth;
+    return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include<climits>
+#include"functions.h"
+
+/// Types of the numbers of the processor, written to the traces
+enum ValueKind
+{
+    VALUE_DOUBLE = 1,
+    VALUE_INT64 = 2,
+};
+
+/// Arithmetic of the processor on numbers of type T
+template<class T>
+struct ValueTraits;
+
+/// Numbers of the original processor: flags are compared with eps,
+/// MOD and CMP go through int
+template<>
+struct ValueTraits<double>
+{
+    static const ValueKind kind = VALUE_DOUBLE;
+
+    static double FromDouble(double value) { return value; }
+    static double ToDouble(double value) { return value; }
+
+    /// Sign of the result for the flags
+    static int Sign(double res) { return Compare(res, 0); }
+    /// Result of CMP for the flags, the difference is truncated
+    static double Difference(double up, double down) { return (int)(up - down); }
+    static bool IsZero(double value) { return Compare(value, 0) == 0; }
+    static bool IsNegative(double value) { return Compare(value, 0) == -1; }
+
+    static double Add(double up, double down) { return up + down; }
+    static double Sub(double up, double down) { return up - down; }
+    static double Mul(double up, double down) { return up * down; }
+    static double Div(double up, double down) { return up / down; }
+    static double Mod(double up, double down) { return (int)up % (int)down; }
+    static double Sqrt(double value) { return sqrt(value); }
+    static double Abs(double value) { return fabs(value); }
+};
+
+/// Exact integers: no eps, native MOD.
+/// Overflow wraps around as in the hardware instead of undefined behaviour
+template<>
+struct ValueTraits<int64_t>
+{
+    static const ValueKind kind = VALUE_INT64;
+
+    ///@note Fractions are truncated, NaN is 0, big numbers are saturated
+    static int64_t FromDouble(double value)
+    {
+        if(value != value)
+            return 0;
+        if(value >= 9223372036854775807.0)
+            return LLONG_MAX;
+        if(value <= -9223372036854775808.0)
+            return LLONG_MIN;
+        return (int64_t)value;
+    }
+    static double ToDouble(int64_t value) { return (double)value; }
+
+    static int Sign(int64_t res) { return (res > 0) - (res < 0); }
+    /// Only the sign of the difference, it can't overflow
+    static int64_t Difference(int64_t up, int64_t down) { return (up > down) - (up < down); }
+    static bool IsZero(int64_t value) { return value == 0; }
+    static bool IsNegative(int64_t value) { return value < 0; }
+
+    static int64_t Add(int64_t up, int64_t down) { return (int64_t)((uint64_t)up + (uint64_t)down); }
+    static int64_t Sub(int64_t up, int64_t down) { return (int64_t)((uint64_t)up - (uint64_t)down); }
+    static int64_t Mul(int64_t up, int64_t down) { return (int64_t)((uint64_t)up * (uint64_t)down); }
+    /// The only overflow of the division is LLONG_MIN / -1
+    static int64_t Div(int64_t up, int64_t down) { return (down == -1) ? Sub(0, up) : up / down; }
+    static int64_t Mod(int64_t up, int64_t down) { return (down == -1) ? 0 : up % down; }
+    static int64_t Abs(int64_t value) { return (value < 0) ? Sub(0, value) : value; }
+
+    ///@return Floor of the root, value must not be negative
+    static int64_t Sqrt(int64_t value)
+    {
+        uint64_t root = (uint64_t)sqrt((double)value);
+        while(root * root > (uint64_t)value)
+            --root;
+        while((root + 1) * (root + 1) <= (uint64_t)value)
+            ++root;
+        return root;
+    }
+};